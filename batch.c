@@ -0,0 +1,470 @@
+#define _DEFAULT_SOURCE
+#include "batch.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+// Opening, reading and closing files as well as probing for opcodes
+// came with the headers of Linux 5.6. IORING_OP_* are enumerators, so
+// test for a macro of the same release. Older headers get plain system
+// calls only.
+#if defined(__NR_io_uring_setup) && defined(IO_URING_OP_SUPPORTED)
+#define USE_URING
+#endif
+
+#ifdef USE_URING
+struct uring {
+	int fd;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_map;
+	size_t sq_size;
+	void *cq_map;
+	size_t cq_size;
+	size_t sqes_size;
+	unsigned pending;
+};
+
+static void uring_exit(struct uring *ring) {
+	if (ring->sqes) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->cq_map && ring->cq_map != ring->sq_map) {
+		munmap(ring->cq_map, ring->cq_size);
+	}
+	if (ring->sq_map) {
+		munmap(ring->sq_map, ring->sq_size);
+	}
+	if (ring->fd > -1) {
+		close(ring->fd);
+	}
+}
+
+static int uring_init(struct uring *ring, unsigned entries) {
+	memset(ring, 0, sizeof(*ring));
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0) {
+		return 0;
+	}
+	ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_size = p.cq_off.cqes +
+			p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_size > ring->sq_size) {
+			ring->sq_size = ring->cq_size;
+		}
+		ring->cq_size = ring->sq_size;
+	}
+	ring->sq_map = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED) {
+		ring->sq_map = NULL;
+		uring_exit(ring);
+		return 0;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_map = ring->sq_map;
+	} else {
+		ring->cq_map = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_map == MAP_FAILED) {
+			ring->cq_map = NULL;
+			uring_exit(ring);
+			return 0;
+		}
+	}
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		uring_exit(ring);
+		return 0;
+	}
+	char *sq = ring->sq_map;
+	char *cq = ring->cq_map;
+	ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+	ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+	ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+	ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+	ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+	return 1;
+}
+
+// Return true if the kernel supports all given opcodes. Kernels before
+// 5.6 can neither open files with io_uring nor probe it, so probing
+// fails there.
+static int uring_supports(struct uring *ring, const uint8_t *ops,
+		unsigned n) {
+	unsigned max = 256;
+	struct io_uring_probe *probe = calloc(1, sizeof(*probe) +
+			max * sizeof(struct io_uring_probe_op));
+	if (!probe) {
+		return 0;
+	}
+	int ok = syscall(__NR_io_uring_register, ring->fd,
+			IORING_REGISTER_PROBE, probe, max) == 0;
+	for (unsigned i = 0; ok && i < n; ++i) {
+		ok = ops[i] <= probe->last_op &&
+				(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+	}
+	free(probe);
+	return ok;
+}
+
+static struct io_uring_sqe *uring_sqe(struct uring *ring, uint8_t opcode,
+		int fd, uint64_t user_data) {
+	unsigned tail = *ring->sq_tail + ring->pending;
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = ring->sqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = user_data;
+	ring->sq_array[index] = index;
+	++ring->pending;
+	return sqe;
+}
+
+// Submit all pending entries and wait until all of them completed.
+// Returns 1 on success. On failure, entries the kernel did not consume
+// are taken back so they are not submitted again by a later call, and
+// those it did consume are waited for, because they may still write to
+// their buffers. Returns 0 then, or -1 if even waiting failed and
+// requests may still be in flight.
+static int uring_submit_and_wait(struct uring *ring) {
+	unsigned n = ring->pending;
+	unsigned submit = n;
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + n, __ATOMIC_RELEASE);
+	ring->pending = 0;
+	int failed = 0;
+	for (;;) {
+		// After a failure, only wait for what the kernel consumed.
+		unsigned wait = failed ? n - submit : n;
+		unsigned done = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) -
+				*ring->cq_head;
+		if (done >= wait && (submit == 0 || failed)) {
+			return !failed;
+		}
+		long r = syscall(__NR_io_uring_enter, ring->fd,
+				failed ? 0 : submit, wait, IORING_ENTER_GETEVENTS,
+				NULL, 0);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		} else if (failed) {
+			if (r < 0) {
+				return -1;
+			}
+		} else if (r < 0 || (r == 0 && submit > 0)) {
+			// The kernel did not take everything.
+			failed = 1;
+			__atomic_store_n(ring->sq_tail, *ring->sq_tail - submit,
+					__ATOMIC_RELEASE);
+		} else {
+			submit -= (unsigned long) r < submit ? (unsigned) r : submit;
+		}
+	}
+}
+
+// Pass every completion to fn and return the number of completions.
+static unsigned uring_reap(struct uring *ring,
+		void (*fn)(uint64_t, int, void *), void *user) {
+	unsigned head = *ring->cq_head;
+	unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	unsigned n = 0;
+	for (; head != tail; ++head, ++n) {
+		struct io_uring_cqe *cqe = ring->cqes + (head & *ring->cq_mask);
+		fn(cqe->user_data, cqe->res, user);
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return n;
+}
+#endif
+
+struct slot {
+	int fd;
+	long len;
+	char *data;
+};
+
+#ifdef USE_URING
+static void store_fd(uint64_t index, int res, void *user) {
+	((struct slot *) user)[index].fd = res < 0 ? -1 : res;
+}
+
+static void store_len(uint64_t index, int res, void *user) {
+	((struct slot *) user)[index].len = res;
+}
+
+static void store_closed(uint64_t index, int res, void *user) {
+	(void) res;
+	((struct slot *) user)[index].fd = -1;
+}
+
+// Open, read and close a batch of files with one submission each.
+// Returns 1 on success. Otherwise, no file that is known to be open is
+// left open and the batch needs to be read again. Returns 0 then, or -1
+// if reads may still land in the buffers of the slots.
+static int uring_read_batch(struct uring *ring, char **paths,
+		struct slot *slots, unsigned batch, size_t max_size) {
+	for (unsigned i = 0; i < batch; ++i) {
+		slots[i].fd = -1;
+		slots[i].len = -1;
+		struct io_uring_sqe *sqe = uring_sqe(ring, IORING_OP_OPENAT,
+				AT_FDCWD, i);
+		sqe->addr = (uintptr_t) paths[i];
+		sqe->open_flags = O_RDONLY;
+	}
+	int status = uring_submit_and_wait(ring);
+	uring_reap(ring, store_fd, slots);
+	unsigned reads = 0;
+	for (unsigned i = 0; status > 0 && i < batch; ++i) {
+		if (slots[i].fd < 0) {
+			continue;
+		}
+		struct io_uring_sqe *sqe = uring_sqe(ring, IORING_OP_READ,
+				slots[i].fd, i);
+		sqe->addr = (uintptr_t) slots[i].data;
+		sqe->len = max_size + 1;
+		++reads;
+	}
+	if (reads > 0) {
+		status = uring_submit_and_wait(ring);
+		uring_reap(ring, store_len, slots);
+	}
+	unsigned closes = 0;
+	for (unsigned i = 0; status > 0 && i < batch; ++i) {
+		if (slots[i].fd > -1) {
+			uring_sqe(ring, IORING_OP_CLOSE, slots[i].fd, i);
+			++closes;
+		}
+	}
+	if (closes > 0) {
+		status = uring_submit_and_wait(ring);
+		uring_reap(ring, store_closed, slots);
+	}
+	for (unsigned i = 0; i < batch; ++i) {
+		if (slots[i].fd > -1) {
+			close(slots[i].fd);
+			slots[i].fd = -1;
+		}
+	}
+	return status;
+}
+#endif
+
+static void read_file(const char *path, struct slot *slot,
+		size_t max_size) {
+	slot->len = -1;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	ssize_t n;
+	do {
+		n = read(fd, slot->data, max_size + 1);
+	} while (n < 0 && errno == EINTR);
+	slot->len = n;
+	close(fd);
+}
+
+int batch_read_files(char **paths, size_t n, unsigned queue_depth,
+		size_t max_size, batch_callback callback, void *user) {
+	if (queue_depth < 1) {
+		queue_depth = 1;
+	}
+	struct slot *slots = calloc(queue_depth, sizeof(struct slot));
+	// Reserve one more byte to detect files that are too large and
+	// another one for the terminating null.
+	size_t size = queue_depth * (max_size + 2);
+	char *buffers = malloc(size);
+	if (!slots || !buffers) {
+		free(slots);
+		free(buffers);
+		return -1;
+	}
+	for (unsigned i = 0; i < queue_depth; ++i) {
+		slots[i].data = buffers + i * (max_size + 2);
+	}
+	int use_uring = 0;
+#ifdef USE_URING
+	struct uring ring;
+	static const uint8_t ops[] = {
+		IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE
+	};
+	use_uring = uring_init(&ring, queue_depth);
+	if (use_uring && !uring_supports(&ring, ops, sizeof(ops))) {
+		uring_exit(&ring);
+		use_uring = 0;
+	}
+#endif
+	int result = 0;
+	for (size_t offset = 0; offset < n && !result; offset += queue_depth) {
+		unsigned batch = n - offset < queue_depth
+			? n - offset
+			: queue_depth;
+#ifdef USE_URING
+		int status = use_uring
+			? uring_read_batch(&ring, paths + offset, slots, batch,
+					max_size)
+			: 1;
+		if (status < 1) {
+			uring_exit(&ring);
+			use_uring = 0;
+		}
+		if (status < 0) {
+			// Late reads may still land in the old buffers, so leave
+			// them to the kernel and read into new ones.
+			if (!(buffers = malloc(size))) {
+				result = -1;
+				break;
+			}
+			for (unsigned i = 0; i < queue_depth; ++i) {
+				slots[i].data = buffers + i * (max_size + 2);
+			}
+		}
+#endif
+		if (!use_uring) {
+			for (unsigned i = 0; i < batch; ++i) {
+				read_file(paths[offset + i], slots + i, max_size);
+			}
+		}
+		for (unsigned i = 0; i < batch && !result; ++i) {
+			struct slot *slot = slots + i;
+			if (slot->len < 0 || (size_t) slot->len > max_size) {
+				slot->len = -1;
+				*slot->data = 0;
+			} else {
+				slot->data[slot->len] = 0;
+			}
+			result = callback(paths[offset + i], slot->data, slot->len,
+					user);
+		}
+	}
+#ifdef USE_URING
+	if (use_uring) {
+		uring_exit(&ring);
+	}
+#endif
+	free(buffers);
+	free(slots);
+	return result;
+}
+
+static int append_path(char ***paths, size_t *n, size_t *cap,
+		const char *path) {
+	if (*n >= *cap) {
+		size_t c = *cap ? *cap * 2 : 1024;
+		char **p = realloc(*paths, c * sizeof(char *));
+		if (!p) {
+			return 0;
+		}
+		*paths = p;
+		*cap = c;
+	}
+	char *copy = malloc(strlen(path) + 1);
+	if (!copy) {
+		return 0;
+	}
+	strcpy(copy, path);
+	(*paths)[(*n)++] = copy;
+	return 1;
+}
+
+static int compare_paths(const void *a, const void *b) {
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+char **batch_list_directory(const char *dir, size_t *n) {
+	DIR *d = opendir(dir);
+	if (!d) {
+		return NULL;
+	}
+	char **paths = NULL;
+	size_t cap = 0;
+	*n = 0;
+	struct dirent *e;
+	while ((e = readdir(d))) {
+		char path[4096];
+		struct stat sb;
+		if (*e->d_name == '.' ||
+				snprintf(path, sizeof(path), "%s/%s", dir, e->d_name) >=
+						(int) sizeof(path)) {
+			continue;
+		}
+		// Only stat() entries whose type readdir() doesn't tell or
+		// that may link to a regular file.
+		if (e->d_type != DT_REG && (
+				(e->d_type != DT_UNKNOWN && e->d_type != DT_LNK) ||
+				stat(path, &sb) || !S_ISREG(sb.st_mode))) {
+			continue;
+		}
+		if (!append_path(&paths, n, &cap, path)) {
+			batch_free_paths(paths, *n);
+			closedir(d);
+			return NULL;
+		}
+	}
+	closedir(d);
+	if (*n > 0) {
+		qsort(paths, *n, sizeof(char *), compare_paths);
+	} else {
+		paths = malloc(sizeof(char *));
+	}
+	return paths;
+}
+
+char **batch_read_list(const char *list, size_t *n) {
+	FILE *fp = strcmp(list, "-") ? fopen(list, "r") : stdin;
+	if (!fp) {
+		return NULL;
+	}
+	char **paths = malloc(sizeof(char *));
+	size_t cap = 1;
+	*n = 0;
+	char line[4096];
+	while (paths && fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = 0;
+		if (*line && !append_path(&paths, n, &cap, line)) {
+			batch_free_paths(paths, *n);
+			paths = NULL;
+		}
+	}
+	if (fp != stdin) {
+		fclose(fp);
+	}
+	return paths;
+}
+
+void batch_free_paths(char **paths, size_t n) {
+	if (!paths) {
+		return;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		free(paths[i]);
+	}
+	free(paths);
+}
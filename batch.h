@@ -0,0 +1,26 @@
+#ifndef __batch_h__
+#define __batch_h__
+
+#include <stddef.h>
+
+// Called for every file in the order of paths. data is null-terminated
+// and len is -1 if the file cannot be read or is larger than max_size.
+// Return non-zero to stop reading.
+typedef int (*batch_callback)(const char *path, char *data, long len,
+		void *user);
+
+// Read many small files with batched io_uring submissions, using up
+// to queue_depth files per batch. Falls back to plain system calls if
+// io_uring is not available. Returns the first non-zero result of the
+// callback.
+int batch_read_files(char **paths, size_t n, unsigned queue_depth,
+		size_t max_size, batch_callback callback, void *user);
+
+// Collect the paths of all regular files in a directory, sorted by
+// name, or the lines of a file list. The returned array and all paths
+// need to be freed with batch_free_paths().
+char **batch_list_directory(const char *dir, size_t *n);
+char **batch_read_list(const char *list, size_t *n);
+void batch_free_paths(char **paths, size_t n);
+
+#endif
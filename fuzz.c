@@ -0,0 +1,265 @@
+// libFuzzer target that makes sure the work per call stays bounded.
+//
+// Every input is parsed while counting the instructions (or, if
+// hardware counters are unavailable, the CPU time) that parse_mrz()
+// and parse_mrz_utf8() take. The fuzzer aborts as soon as a single
+// call exceeds the budget from MRZ_FUZZ_BUDGET. It also aborts if a
+// reused parser context gives a different result than parse_mrz() or
+// if a watchlist built from the lines of the input gives other hits
+// than a naive scan.
+//
+// Build with `make fuzz` or, without libFuzzer, with
+// `make fuzz FUZZ_CC=cc FUZZ_FLAGS=-DMRZ_FUZZ_STANDALONE` to run
+// the inputs given as arguments.
+#define _GNU_SOURCE
+#define MRZ_PARSER_IMPLEMENTATION
+#include "mrzparser.h"
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Default budgets per call.
+#define BUDGET_INSTRUCTIONS 200000
+#define BUDGET_NANOSECONDS 2000000
+
+// Lines of an input that make up a watchlist.
+#define WATCHLIST_ENTRIES 64
+
+static int counter = -1;
+static long long budget;
+static const char *unit;
+
+static void setup(void) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	counter = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	unit = counter > -1 ? "instructions" : "ns";
+	const char *env = getenv("MRZ_FUZZ_BUDGET");
+	budget = env ? atoll(env) : counter > -1
+		? BUDGET_INSTRUCTIONS
+		: BUDGET_NANOSECONDS;
+}
+
+static long long now(void) {
+	if (counter > -1) {
+		long long count = 0;
+		if (read(counter, &count, sizeof(count)) != sizeof(count)) {
+			abort();
+		}
+		return count;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void measure(const char *name, int (*parse)(MRZ *, const char *),
+		const char *s) {
+	MRZ mrz;
+	if (counter > -1) {
+		ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+		ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	long long start = now();
+	parse(&mrz, s);
+	long long cost = now() - start;
+	if (counter > -1) {
+		ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+	}
+	if (cost > budget) {
+		fprintf(stderr, "%s() took %lld %s for %zu bytes, budget is %lld\n",
+				name, cost, unit, strlen(s), budget);
+		abort();
+	}
+}
+
+static int same_names(const MRZ_NAMES *a, const MRZ_NAMES *b) {
+	return a->count == b->count && a->truncated == b->truncated &&
+			!memcmp(a->offset, b->offset, a->count) &&
+			!memcmp(a->length, b->length, a->count);
+}
+
+#define SAME(field) !strcmp(a->field, b->field)
+static int same(const MRZ *a, const MRZ *b) {
+	return SAME(document_code) && SAME(issuing_state) &&
+			SAME(primary_identifier) && SAME(secondary_identifier) &&
+			SAME(nationality) && SAME(document_number) &&
+			SAME(date_of_birth) && SAME(sex) && SAME(date_of_expiry) &&
+			SAME(optional_data1) && SAME(optional_data2) &&
+			SAME(blank_number) && SAME(language) &&
+			SAME(bac_information) && SAME(printed_date_of_birth) &&
+			SAME(printed_date_of_expiry) &&
+			!memcmp(a->errors, b->errors, sizeof(a->errors)) &&
+			a->error_mask == b->error_mask &&
+			!memcmp(a->status, b->status, sizeof(a->status)) &&
+			same_names(&a->primary_names, &b->primary_names) &&
+			same_names(&a->secondary_names, &b->secondary_names) &&
+			a->pseudonymized == b->pseudonymized &&
+			a->rejected == b->rejected &&
+			(!a->pseudonymized ||
+				!memcmp(a->tokens, b->tokens, sizeof(a->tokens)));
+}
+#undef SAME
+
+static void compare_context(const char *s) {
+	// Kept across inputs, so every parse has to clean up after the
+	// previous one.
+	static MRZ_CONTEXT ctx;
+	MRZ mrz;
+	if (parse_mrz_ctx(&ctx, s) != parse_mrz(&mrz, s) ||
+			!same(&ctx.mrz, &mrz)) {
+		fprintf(stderr, "parse_mrz_ctx() differs from parse_mrz()\n");
+		abort();
+	}
+	// Pseudonymizing context, single and batch must agree.
+	static const unsigned char key[MRZ_PSEUDONYM_KEY_LENGTH] = {1, 2, 3};
+	static MRZ_CONTEXT pctx;
+	MRZ batch = mrz;
+	mrz_context_pseudonymize(&pctx, key);
+	parse_mrz_ctx(&pctx, s);
+	mrz_pseudonymize(&mrz, key);
+	mrz_pseudonymize_batch(&batch, 1, key);
+	if (!same(&pctx.mrz, &mrz) || !same(&batch, &mrz)) {
+		fprintf(stderr, "pseudonymization differs\n");
+		abort();
+	}
+}
+
+// Plain dynamic programming, to have something simple to compare with.
+static int levenshtein(const char *a, size_t m, const char *b, size_t n) {
+	int row[MRZ_WATCHLIST_NAME_MAX + 1];
+	for (size_t j = 0; j <= n; ++j) {
+		row[j] = (int) j;
+	}
+	for (size_t i = 1; i <= m; ++i) {
+		int diagonal = row[0];
+		row[0] = (int) i;
+		for (size_t j = 1; j <= n; ++j) {
+			int d = diagonal + (a[i - 1] != b[j - 1]);
+			diagonal = row[j];
+			if (row[j] + 1 < d) {
+				d = row[j] + 1;
+			}
+			if (row[j - 1] + 1 < d) {
+				d = row[j - 1] + 1;
+			}
+			row[j] = d;
+		}
+	}
+	return row[n];
+}
+
+static void query_watchlist(const void *index, char names[][
+		MRZ_WATCHLIST_NAME_MAX], const size_t *lengths, size_t n,
+		const MRZ *mrz) {
+	char name[MRZ_WATCHLIST_NAME_MAX];
+	size_t m = mrz_watchlist_normalize(name, mrz->primary_identifier,
+			mrz->secondary_identifier);
+	for (int max_distance = 0; max_distance < 4; ++max_distance) {
+		MRZ_WATCHLIST_HIT hits[WATCHLIST_ENTRIES];
+		size_t nhits = mrz_watchlist_query(index, mrz, max_distance,
+				hits, WATCHLIST_ENTRIES);
+		size_t expected = 0;
+		for (size_t i = 0; i < n; ++i) {
+			expected += levenshtein(name, m, names[i], lengths[i]) <=
+					max_distance;
+		}
+		for (size_t i = 0; i < nhits && nhits == expected; ++i) {
+			uint32_t e = hits[i].entry;
+			if (e >= n || hits[i].distance != levenshtein(name, m,
+					names[e], lengths[e]) ||
+					(i > 0 && hits[i - 1].distance > hits[i].distance)) {
+				expected = nhits + 1;
+			}
+		}
+		if (nhits != expected) {
+			fprintf(stderr, "mrz_watchlist_query() differs from naive "
+					"scan for \"%.*s\" within %d\n", (int) m, name,
+					max_distance);
+			abort();
+		}
+	}
+}
+
+static void compare_watchlist(const char *s) {
+	// Every line is a name in MRZ notation.
+	char *copy = strdup(s);
+	if (!copy) {
+		return;
+	}
+	const char *entries[WATCHLIST_ENTRIES];
+	size_t n = 0;
+	for (char *line = strtok(copy, "\n"); line && n < WATCHLIST_ENTRIES;
+			line = strtok(NULL, "\n")) {
+		entries[n++] = line;
+	}
+	size_t size;
+	void *index = mrz_watchlist_build(entries, n, &size);
+	if (!index || !mrz_watchlist_check(index, size)) {
+		fprintf(stderr, "mrz_watchlist_build() failed\n");
+		abort();
+	}
+	static char names[WATCHLIST_ENTRIES][MRZ_WATCHLIST_NAME_MAX];
+	size_t lengths[WATCHLIST_ENTRIES];
+	for (size_t i = 0; i < n; ++i) {
+		lengths[i] = mrz_watchlist_normalize_entry(names[i], entries[i]);
+	}
+	// Query with the whole input as well as every single entry.
+	MRZ mrz;
+	parse_mrz(&mrz, s);
+	query_watchlist(index, names, lengths, n, &mrz);
+	for (size_t i = 0; i < n; ++i) {
+		memset(&mrz, 0, sizeof(mrz));
+		mrz_parse_identifiers(&mrz, entries[i]);
+		query_watchlist(index, names, lengths, n, &mrz);
+	}
+	free(index);
+	free(copy);
+}
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (!unit) {
+		setup();
+	}
+	char *s = malloc(size + 1);
+	if (!s) {
+		return 0;
+	}
+	memcpy(s, data, size);
+	s[size] = 0;
+	measure("parse_mrz", parse_mrz, s);
+	measure("parse_mrz_utf8", parse_mrz_utf8, s);
+	compare_context(s);
+	compare_watchlist(s);
+	free(s);
+	return 0;
+}
+
+#ifdef MRZ_FUZZ_STANDALONE
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		FILE *fp = fopen(argv[i], "rb");
+		if (!fp) {
+			perror(argv[i]);
+			return -1;
+		}
+		static uint8_t data[1 << 24];
+		size_t size = fread(data, 1, sizeof(data), fp);
+		fclose(fp);
+		LLVMFuzzerTestOneInput(data, size);
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,382 @@
+#define _POSIX_C_SOURCE 200809L
+#include "input.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+static int input_fill(struct input *in) {
+	if (in->pos > 0) {
+		memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+		in->len -= in->pos;
+		in->offset += in->pos;
+		in->pos = 0;
+	}
+	size_t space = INPUT_BUFFER_SIZE - in->len;
+	if (in->eof || space < 1) {
+		return 0;
+	}
+	ssize_t n;
+	do {
+		n = read(in->fd, in->buf + in->len, space);
+	} while (n < 0 && errno == EINTR);
+	if (n < 1) {
+		in->eof = 1;
+		return 0;
+	}
+	in->len += n;
+	return 1;
+}
+
+static int is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static int is_blank(const char *p, size_t from, size_t to) {
+	for (; from < to; ++from) {
+		if (!is_space(p[from])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Find the end of the line that starts at from. At the end of input,
+// the last line may end without a line break.
+static int line_end(const char *p, size_t n, size_t from, int eof,
+		size_t *end) {
+	if (from >= n) {
+		*end = n;
+		return 0;
+	}
+	const char *nl = memchr(p + from, '\n', n - from);
+	if (nl) {
+		*end = nl - p;
+		return 1;
+	}
+	*end = n;
+	return eof && from < n;
+}
+
+// Skip leading blank lines and return the start of the first line that
+// isn't blank.
+static int skip_blank_lines(const char *p, size_t n, int eof,
+		size_t *start) {
+	size_t i = 0;
+	for (;;) {
+		size_t e;
+		if (!line_end(p, n, i, eof, &e)) {
+			return 0;
+		}
+		if (!is_blank(p, i, e)) {
+			*start = i;
+			return 1;
+		}
+		i = e + 1;
+	}
+}
+
+// Guess the number of lines of a MRZ from the length of its first line.
+static int lines_for_length(const char *p, size_t from, size_t to) {
+	int count = 0;
+	for (; from < to; ++from) {
+		count += !is_space(p[from]);
+	}
+	switch (count) {
+	case 9: // Swiss driver license.
+	case 30:
+		return 3;
+	case 36:
+	case 44:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+// Find the record at the start of p. Returns 1 and sets the offset and
+// length of the record and the number of bytes to consume, or 0 if
+// more input is needed.
+static int frame(struct input *in, char *p, size_t n, size_t *start,
+		size_t *len, size_t *skip) {
+	int eof = in->eof;
+	switch (in->framing) {
+	default:
+	case FRAMING_LINE:
+	case FRAMING_NUL: {
+		const char *d = memchr(p, in->framing == FRAMING_NUL ? 0 : '\n',
+				n);
+		*start = 0;
+		if (d) {
+			*len = d - p;
+			*skip = *len + 1;
+			return 1;
+		}
+		*len = *skip = n;
+		return eof && n > 0;
+	}
+	case FRAMING_LINES: {
+		if (!skip_blank_lines(p, n, eof, start)) {
+			return 0;
+		}
+		size_t i = *start;
+		size_t e = i;
+		int lines = in->lines;
+		for (int l = 0; !l || l < lines; ++l) {
+			if (!line_end(p, n, i, eof, &e)) {
+				if (!eof) {
+					return 0;
+				}
+				break;
+			}
+			if (!l && !lines) {
+				lines = lines_for_length(p, i, e);
+			}
+			i = e + 1;
+		}
+		*len = e - *start;
+		*skip = e < n ? e + 1 : n;
+		return 1;
+	}
+	case FRAMING_BLANK: {
+		if (!skip_blank_lines(p, n, eof, start)) {
+			return 0;
+		}
+		size_t i = *start;
+		size_t e;
+		for (;;) {
+			if (!line_end(p, n, i, eof, &e)) {
+				if (!eof) {
+					return 0;
+				}
+				*len = n - *start;
+				*skip = n;
+				return 1;
+			}
+			if (is_blank(p, i, e)) {
+				break;
+			}
+			i = e + 1;
+		}
+		*len = i - *start;
+		// Consume all blank lines after the record too, so the next
+		// record begins with the first line that isn't blank.
+		for (;;) {
+			if (e >= n) {
+				*skip = n;
+				return 1;
+			}
+			i = e + 1;
+			if (!line_end(p, n, i, eof, &e)) {
+				if (!eof) {
+					return 0;
+				}
+				*skip = n;
+				return 1;
+			}
+			if (!is_blank(p, i, e)) {
+				*skip = i;
+				return 1;
+			}
+		}
+	}
+	case FRAMING_LENGTH: {
+		if (n < 4) {
+			*start = 0;
+			*len = *skip = n;
+			if (eof && n > 0) {
+				in->failed = 1;
+				return 1;
+			}
+			return 0;
+		}
+		const unsigned char *u = (const unsigned char *) p;
+		size_t l = (size_t) u[0] << 24 | (size_t) u[1] << 16 |
+				(size_t) u[2] << 8 | u[3];
+		*start = 4;
+		if (l > in->max_record || n - 4 < l) {
+			if (l > in->max_record || eof) {
+				// Too long or truncated.
+				*len = n - 4 < l ? n - 4 : l;
+				*skip = n;
+				in->failed = 1;
+				return 1;
+			}
+			return 0;
+		}
+		*len = l;
+		*skip = 4 + l;
+		return 1;
+	}
+	}
+}
+
+char *input_next(struct input *in, size_t *len, int *too_long) {
+	*too_long = 0;
+	if (in->failed) {
+		return NULL;
+	}
+	for (;;) {
+		if (in->end > -1 && in->offset + (off_t) in->pos >= in->end) {
+			return NULL;
+		}
+		char *p = in->buf + in->pos;
+		size_t n = in->len - in->pos;
+		size_t start, skip;
+		if (!frame(in, p, n, &start, len, &skip)) {
+			if (input_fill(in)) {
+				continue;
+			}
+			p = in->buf + in->pos;
+			n = in->len - in->pos;
+			if (!in->eof) {
+				// The buffer is full but the record isn't complete.
+				in->failed = 1;
+				*len = n;
+				*too_long = 1;
+				p[n] = 0;
+				return p;
+			}
+			if (n < 1 || !frame(in, p, n, &start, len, &skip)) {
+				return NULL;
+			}
+		}
+		in->pos += skip;
+		char *record = p + start;
+		if (in->failed || *len > in->max_record) {
+			in->failed = 1;
+			*too_long = 1;
+		}
+		// The byte after the record belongs to its delimiter or to the
+		// next record, which is why the length prefix must be moved.
+		if (in->framing == FRAMING_LENGTH && !in->failed) {
+			memmove(p, record, *len);
+			record = p;
+		}
+		record[*len] = 0;
+		return record;
+	}
+}
+
+int input_ready(struct input *in) {
+	if (in->failed || in->pos >= in->len ||
+			(in->end > -1 && in->offset + (off_t) in->pos >= in->end)) {
+		return 0;
+	}
+	// Framing may flag a bad record, which input_next() has to see
+	// again to report it.
+	int failed = in->failed;
+	size_t start, len, skip;
+	int ready = frame(in, in->buf + in->pos, in->len - in->pos, &start,
+			&len, &skip);
+	in->failed = failed;
+	return ready;
+}
+
+// Check if the line that is terminated by the line break at pos is
+// blank by looking backwards from there.
+static int blank_line_before(int fd, off_t pos) {
+	char buf[256];
+	while (pos > 0) {
+		off_t from = pos > (off_t) sizeof(buf)
+			? pos - (off_t) sizeof(buf)
+			: 0;
+		ssize_t n = pread(fd, buf, pos - from, from);
+		if (n != pos - from) {
+			return 0;
+		}
+		for (ssize_t i = n; i-- > 0; ) {
+			if (buf[i] == '\n') {
+				return 1;
+			} else if (!is_space(buf[i])) {
+				return 0;
+			}
+		}
+		pos = from;
+	}
+	// The beginning of the input counts as blank line.
+	return 1;
+}
+
+// Move to the first line that isn't blank and follows a blank line.
+// blank tells if the line before the current position is blank.
+static void align_blank(struct input *in, int blank) {
+	size_t i = in->pos;
+	int line_blank = 1;
+	for (;;) {
+		if (i >= in->len) {
+			size_t shift = in->pos;
+			if (input_fill(in)) {
+				i -= shift;
+				continue;
+			}
+			if (in->eof) {
+				in->pos = in->len;
+				return;
+			}
+			// A line that doesn't fit into the buffer.
+			in->pos = i;
+			continue;
+		}
+		char c = in->buf[i++];
+		if (c == '\n') {
+			blank = line_blank;
+			line_blank = 1;
+			in->pos = i;
+		} else if (!is_space(c) && line_blank) {
+			if (blank) {
+				return;
+			}
+			line_blank = 0;
+		}
+	}
+}
+
+int input_open(struct input *in, int fd, int framing, int lines,
+		size_t max_record, off_t start, off_t end) {
+	in->fd = fd;
+	in->framing = framing;
+	in->lines = lines;
+	in->max_record = max_record;
+	in->len = 0;
+	in->pos = 0;
+	in->offset = 0;
+	in->end = end;
+	in->eof = 0;
+	in->failed = 0;
+	if (start < 1) {
+		if (framing == FRAMING_BLANK) {
+			// So the first record begins after leading blank lines,
+			// just like every other record.
+			align_blank(in, 1);
+		}
+		return 1;
+	}
+	if (framing != FRAMING_LINE && framing != FRAMING_NUL &&
+			framing != FRAMING_BLANK) {
+		return 0;
+	}
+	// Records begin right after a delimiter, so start looking for one
+	// at the byte before the range.
+	if (lseek(fd, start - 1, SEEK_SET) < 0) {
+		return 0;
+	}
+	in->offset = start - 1;
+	int d = framing == FRAMING_NUL ? 0 : '\n';
+	for (;;) {
+		if (in->pos >= in->len && !input_fill(in)) {
+			return 1;
+		}
+		char *q = memchr(in->buf + in->pos, d, in->len - in->pos);
+		if (q) {
+			in->pos = q - in->buf + 1;
+			break;
+		}
+		in->pos = in->len;
+	}
+	if (framing == FRAMING_BLANK) {
+		align_blank(in, blank_line_before(fd,
+				in->offset + (off_t) in->pos - 1));
+	}
+	return 1;
+}
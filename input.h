@@ -0,0 +1,55 @@
+#ifndef __input_h__
+#define __input_h__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define INPUT_BUFFER_SIZE 65536
+
+// One record per line.
+#define FRAMING_LINE 0
+// A fixed number of lines per record or, if lines is 0, as many lines
+// as the length of the first line suggests.
+#define FRAMING_LINES 1
+// Records are separated by blank lines.
+#define FRAMING_BLANK 2
+// Records are terminated by a null byte.
+#define FRAMING_NUL 3
+// Every record is prefixed with its length as 32 bit big endian.
+#define FRAMING_LENGTH 4
+
+struct input {
+	int fd;
+	int framing;
+	int lines;
+	size_t max_record;
+	// One more byte to terminate records in place.
+	char buf[INPUT_BUFFER_SIZE + 1];
+	size_t len;
+	size_t pos;
+	// File offset of buf[0].
+	off_t offset;
+	// Only records that begin before this offset are read.
+	off_t end;
+	int eof;
+	int failed;
+};
+
+// Start reading records from fd that begin in the byte range from
+// start to end (-1 for no limit). The range is aligned to the next
+// record boundary, which is only possible for line, blank line and
+// null byte framing.
+int input_open(struct input *, int fd, int framing, int lines,
+		size_t max_record, off_t start, off_t end);
+
+// Returns the next record in place, terminated by a null byte, or NULL
+// if there are no more records. Sets *too_long if the record is larger
+// than max_record or malformed. No more records are returned after
+// that.
+char *input_next(struct input *, size_t *len, int *too_long);
+
+// Returns 1 if the next record is already in the buffer, so
+// input_next() won't block.
+int input_ready(struct input *);
+
+#endif
@@ -1,20 +1,768 @@
+#define _POSIX_C_SOURCE 200809L
 #define MRZ_PARSER_IMPLEMENTATION
 #include "mrzparser.h"
+#include "batch.h"
+#include "input.h"
+#include "server.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-int main(void) {
-	MRZ mrz;
-	char line[1024];
-	while (fgets(line, sizeof(line), stdin)) {
-		if (!parse_mrz(&mrz, line)) {
-			fprintf(stderr, "FAILED:\n%s\n", line);
-			fprintf(stderr, "ERRORS:\n");
-			for (int *e = mrz.errors; *e; ++e) {
-				fprintf(stderr, "* %s\n", mrz_error_string(*e));
+#define STORE_INITIAL_CAPACITY 1024
+#define DEFAULT_QUEUE_DEPTH 64
+#define COLUMNS_GROUP_ROWS 4096
+#define MAX_WORKERS 1024
+
+struct store {
+	const char *path;
+	int fd;
+	void *map;
+	size_t size;
+};
+
+static int store_map(struct store *st) {
+	struct stat sb;
+	if (fstat(st->fd, &sb)) {
+		return 0;
+	}
+	st->size = sb.st_size;
+	st->map = mmap(NULL, st->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			st->fd, 0);
+	if (st->map == MAP_FAILED) {
+		st->map = NULL;
+		return 0;
+	}
+	return mrz_store_check(st->map, st->size);
+}
+
+static int store_create(int fd, uint64_t capacity) {
+	size_t size = mrz_store_size(capacity);
+	if (ftruncate(fd, size)) {
+		return 0;
+	}
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0);
+	if (map == MAP_FAILED) {
+		return 0;
+	}
+	mrz_store_init(map, capacity);
+	munmap(map, size);
+	return 1;
+}
+
+static int store_open(struct store *st, const char *path) {
+	st->path = path;
+	st->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (st->fd < 0) {
+		return 0;
+	}
+	struct stat sb;
+	if (fstat(st->fd, &sb) ||
+			(sb.st_size == 0 &&
+			!store_create(st->fd, STORE_INITIAL_CAPACITY))) {
+		return 0;
+	}
+	return store_map(st);
+}
+
+static void store_close(struct store *st) {
+	if (st->map) {
+		munmap(st->map, st->size);
+	}
+	if (st->fd > -1) {
+		close(st->fd);
+	}
+}
+
+static int store_grow(struct store *st) {
+	// Rehash into a new file that replaces the old one atomically,
+	// so readers that still map the old file are not affected.
+	char tmp[4096];
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", st->path) >=
+			(int) sizeof(tmp)) {
+		return 0;
+	}
+	int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return 0;
+	}
+	uint64_t capacity = (st->size - mrz_store_size(0)) /
+			sizeof(MRZ_STORE_RECORD) * 2;
+	struct store grown = {st->path, fd, NULL, 0};
+	if (!store_create(fd, capacity) || !store_map(&grown) ||
+			!mrz_store_grow(grown.map, st->map) ||
+			msync(grown.map, grown.size, MS_SYNC) ||
+			rename(tmp, st->path)) {
+		store_close(&grown);
+		unlink(tmp);
+		return 0;
+	}
+	store_close(st);
+	*st = grown;
+	return 1;
+}
+
+static int store_insert(struct store *st, const MRZ *mrz) {
+	int result;
+	while ((result = mrz_store_insert(st->map, mrz)) == MRZ_STORE_FULL) {
+		if (!store_grow(st)) {
+			return MRZ_STORE_FULL;
+		}
+	}
+	return result;
+}
+
+struct columns {
+	FILE *fp;
+	// Rows of the current group.
+	MRZ *rows;
+	uint64_t count;
+	void *group;
+	uint64_t offset;
+	uint64_t *offsets;
+	uint64_t *counts;
+	uint64_t groups;
+	uint64_t cap;
+};
+
+static int columns_open(struct columns *cols, const char *path) {
+	uint64_t header[8];
+	cols->fp = fopen(path, "wb");
+	cols->rows = malloc(COLUMNS_GROUP_ROWS * sizeof(MRZ));
+	cols->group = malloc(mrz_columns_group_size(COLUMNS_GROUP_ROWS));
+	if (!cols->fp || !cols->rows || !cols->group) {
+		return 0;
+	}
+	cols->offset = mrz_columns_header(header);
+	return fwrite(header, 1, cols->offset, cols->fp) == cols->offset;
+}
+
+static int columns_flush(struct columns *cols) {
+	if (cols->count < 1) {
+		return 1;
+	}
+	if (cols->groups >= cols->cap) {
+		uint64_t cap = cols->cap ? cols->cap * 2 : 64;
+		uint64_t *offsets = realloc(cols->offsets, cap * sizeof(uint64_t));
+		if (offsets) {
+			cols->offsets = offsets;
+		}
+		uint64_t *counts = realloc(cols->counts, cap * sizeof(uint64_t));
+		if (counts) {
+			cols->counts = counts;
+		}
+		if (!offsets || !counts) {
+			return 0;
+		}
+		cols->cap = cap;
+	}
+	size_t size = mrz_columns_group_size(cols->count);
+	mrz_columns_group(cols->group, cols->rows, cols->count);
+	if (fwrite(cols->group, 1, size, cols->fp) != size) {
+		return 0;
+	}
+	cols->offsets[cols->groups] = cols->offset;
+	cols->counts[cols->groups++] = cols->count;
+	cols->offset += size;
+	cols->count = 0;
+	return 1;
+}
+
+static int columns_add(struct columns *cols, const MRZ *mrz) {
+	cols->rows[cols->count++] = *mrz;
+	return cols->count < COLUMNS_GROUP_ROWS || columns_flush(cols);
+}
+
+// Write the last group and the footer.
+static int columns_close(struct columns *cols) {
+	int ok = 1;
+	if (cols->fp) {
+		size_t size = mrz_columns_footer_size(cols->groups + 1);
+		void *footer = columns_flush(cols) ? malloc(size) : NULL;
+		if (footer) {
+			size = mrz_columns_footer_size(cols->groups);
+			mrz_columns_footer(footer, cols->offsets, cols->counts,
+					cols->groups);
+			ok = fwrite(footer, 1, size, cols->fp) == size;
+			free(footer);
+		} else {
+			ok = 0;
+		}
+		ok &= !fclose(cols->fp);
+	}
+	free(cols->rows);
+	free(cols->group);
+	free(cols->offsets);
+	free(cols->counts);
+	return ok;
+}
+
+// Write a token as hex digits or nothing if the field was empty.
+static const char *format_token(char *out, const unsigned char *token) {
+	static const char digits[] = "0123456789ABCDEF";
+	char *o = out;
+	int empty = 1;
+	for (int i = 0; i < MRZ_TOKEN_LENGTH; ++i) {
+		*o++ = digits[token[i] >> 4];
+		*o++ = digits[token[i] & 15];
+		empty &= !token[i];
+	}
+	*(empty ? out : o) = 0;
+	return out;
+}
+
+static size_t format_mrz(char *out, size_t cap, const MRZ *mrz) {
+	// Pseudonymized fields are replaced with their tokens.
+	char tokens[MRZ_TOKENS][MRZ_TOKEN_LENGTH * 2 + 1];
+	const char *fields[MRZ_TOKENS] = {
+		mrz->document_number,
+		mrz->date_of_birth,
+		mrz->primary_identifier,
+		mrz->secondary_identifier
+	};
+	if (mrz->pseudonymized) {
+		for (int t = 0; t < MRZ_TOKENS; ++t) {
+			fields[t] = format_token(tokens[t], mrz->tokens[t]);
+		}
+	}
+	int n = snprintf(out, cap,
+			"%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s",
+			mrz->document_code,
+			mrz->issuing_state,
+			fields[MRZ_TOKEN_DOCUMENT_NUMBER],
+			fields[MRZ_TOKEN_PRIMARY_IDENTIFIER],
+			fields[MRZ_TOKEN_SECONDARY_IDENTIFIER],
+			mrz->nationality,
+			fields[MRZ_TOKEN_DATE_OF_BIRTH],
+			mrz->sex,
+			mrz->date_of_expiry,
+			mrz->optional_data1,
+			mrz->optional_data2,
+			mrz->blank_number,
+			mrz->language);
+	return n < 0 ? 0 : (size_t) n < cap ? (size_t) n : cap - 1;
+}
+
+static void print_mrz(const MRZ *mrz) {
+	char line[512];
+	size_t n = format_mrz(line, sizeof(line), mrz);
+	line[n] = '\n';
+	fwrite(line, 1, n + 1, stdout);
+}
+
+static int read_shard_header(FILE *fp, long *index, long *count) {
+	char line[256];
+	return fgets(line, sizeof(line), fp) &&
+			sscanf(line, "# shard %ld/%ld", index, count) == 2 &&
+			*count > 0 && *index > -1 && *index < *count;
+}
+
+// Concatenate the outputs of all shards in shard order, which is the
+// order of the input.
+static int merge(char **paths, int n) {
+	FILE **shards = calloc(n, sizeof(FILE *));
+	if (!shards) {
+		return -1;
+	}
+	int status = 0;
+	long count = -1;
+	for (int i = 0; i < n && !status; ++i) {
+		long index, c;
+		FILE *fp = fopen(paths[i], "r");
+		if (!fp || !read_shard_header(fp, &index, &c) ||
+				(count > -1 && c != count) || c != n || shards[index]) {
+			fprintf(stderr, "error: %s is not a matching shard\n",
+					paths[i]);
+			if (fp) {
+				fclose(fp);
 			}
+			status = -1;
+			break;
+		}
+		count = c;
+		shards[index] = fp;
+	}
+	for (int i = 0; i < n && !status; ++i) {
+		char buf[INPUT_BUFFER_SIZE];
+		size_t len;
+		while ((len = fread(buf, 1, sizeof(buf), shards[i])) > 0) {
+			fwrite(buf, 1, len, stdout);
+		}
+	}
+	for (int i = 0; i < n; ++i) {
+		if (shards[i]) {
+			fclose(shards[i]);
+		}
+	}
+	free(shards);
+	return status;
+}
+
+struct state {
+	// Parser contexts, one per worker in server mode. Filtering and
+	// pseudonymizing are set up in there.
+	MRZ_CONTEXT *ctx;
+	int print;
+	struct store st;
+	const char *store_path;
+	struct columns cols;
+	const char *columns_path;
+	// Set if a record failed to parse but was written to the columnar
+	// file instead of stopping.
+	int failed;
+};
+
+static int hex_digit(char c) {
+	return c >= '0' && c <= '9' ? c - '0'
+		: c >= 'a' && c <= 'f' ? c - 'a' + 10
+		: c >= 'A' && c <= 'F' ? c - 'A' + 10
+		: -1;
+}
+
+// Read a key of MRZ_PSEUDONYM_KEY_LENGTH bytes written as hex digits.
+static int read_key(const char *path, unsigned char *key) {
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		return 0;
+	}
+	char hex[MRZ_PSEUDONYM_KEY_LENGTH * 2 + 2] = {0};
+	int ok = fgets(hex, sizeof(hex), fp) != NULL;
+	fclose(fp);
+	for (int i = 0; ok && i < MRZ_PSEUDONYM_KEY_LENGTH; ++i) {
+		int hi = hex_digit(hex[i * 2]);
+		int lo = hex_digit(hex[i * 2 + 1]);
+		ok = hi > -1 && lo > -1;
+		key[i] = (unsigned char) (hi << 4 | lo);
+	}
+	char end = hex[MRZ_PSEUDONYM_KEY_LENGTH * 2];
+	memset(hex, 0, sizeof(hex));
+	return ok && (!end || end == '\n' || end == '\r');
+}
+
+// The raw record is withheld if record is NULL.
+static void print_failure(const char *record, size_t len, const MRZ *mrz) {
+	if (!record) {
+		record = "(withheld)";
+		len = strlen(record);
+	}
+	fprintf(stderr, "FAILED:\n%.*s\n", (int) len, record);
+	fprintf(stderr, "ERRORS:\n");
+	for (const int *e = mrz->errors; *e; ++e) {
+		fprintf(stderr, "* %s\n", mrz_error_string(*e));
+	}
+}
+
+static int handle_record(struct state *state, const char *record,
+		size_t len) {
+	MRZ_CONTEXT *ctx = state->ctx;
+	const MRZ *mrz = &ctx->mrz;
+	int parsed = parse_mrz_ctx_n(ctx, record, len);
+	if (mrz->rejected) {
+		return 0;
+	}
+	if (!parsed) {
+		print_failure(ctx->pseudonymize ? NULL : record, len, mrz);
+		if (!state->cols.fp) {
+			return -1;
+		}
+		state->failed = 1;
+	} else if (state->print) {
+		print_mrz(mrz);
+	}
+	if (state->cols.fp && !columns_add(&state->cols, mrz)) {
+		fprintf(stderr, "error: cannot write %s\n", state->columns_path);
+		return -1;
+	}
+	if (parsed && state->st.map) {
+		switch (store_insert(&state->st, mrz)) {
+		case MRZ_STORE_EXISTS:
+			printf("REUSED: %s %s\n", *mrz->issuing_state
+					? mrz->issuing_state
+					: mrz->nationality,
+					mrz->document_number);
+			break;
+		case MRZ_STORE_FULL:
+			fprintf(stderr, "error: cannot grow store %s\n",
+					state->store_path);
 			return -1;
 		}
 	}
 	return 0;
 }
+
+// Answer a request in server mode with either "OK" or "FAILED" and
+// the fields or errors, separated by tabs, or with "SKIPPED" if the
+// record doesn't match the filter.
+static size_t respond(const char *record, char *out, size_t cap,
+		unsigned worker, void *user) {
+	struct state *state = user;
+	MRZ_CONTEXT *ctx = state->ctx + worker;
+	const MRZ *mrz = &ctx->mrz;
+	int parsed = parse_mrz_ctx(ctx, record);
+	if (mrz->rejected) {
+		return snprintf(out, cap, "SKIPPED");
+	}
+	if (parsed) {
+		memcpy(out, "OK\t", 3);
+		return 3 + format_mrz(out + 3, cap - 3, mrz);
+	}
+	size_t n = snprintf(out, cap, "FAILED");
+	for (const int *e = mrz->errors; *e && n < cap - 1; ++e) {
+		int w = snprintf(out + n, cap - n, "\t%s", mrz_error_string(*e));
+		n = w < 0 ? cap - 1 : n + w < cap ? n + w : cap - 1;
+	}
+	return n;
+}
+
+static int serve(struct state *state, const char *path, long workers,
+		int framing, int lines) {
+	// Every worker gets a copy of the configured context.
+	MRZ_CONTEXT *contexts = malloc(workers * sizeof(MRZ_CONTEXT));
+	if (!contexts) {
+		fprintf(stderr, "error: out of memory\n");
+		return -1;
+	}
+	for (long i = 0; i < workers; ++i) {
+		contexts[i] = *state->ctx;
+	}
+	state->ctx = contexts;
+	struct server *server = server_create(workers, framing, lines,
+			MRZ_MAX_INPUT, respond, state);
+	if (!server) {
+		fprintf(stderr, "error: cannot start workers\n");
+		free(contexts);
+		return -1;
+	}
+	int status;
+	if (!strcmp(path, "-")) {
+		status = server_run(server, STDIN_FILENO, STDOUT_FILENO);
+	} else {
+		status = server_listen(server, path);
+		fprintf(stderr, status == -1
+				? "error: cannot listen on %s\n"
+				: "error: cannot accept connections on %s\n", path);
+		status = -1;
+	}
+	server_destroy(server);
+	memset(contexts, 0, workers * sizeof(MRZ_CONTEXT));
+	free(contexts);
+	return status;
+}
+
+static int handle_file(const char *path, char *data, long len,
+		void *user) {
+	if (len < 0) {
+		fprintf(stderr, "FAILED:\n%s\n", path);
+		fprintf(stderr, "ERRORS:\n* cannot read file or file larger "
+				"than %d bytes\n", MRZ_MAX_INPUT);
+		return -1;
+	}
+	return handle_record(user, data, len);
+}
+
+static int parse_stream(struct state *state, int fd, int framing,
+		int lines, off_t start, off_t end) {
+	static struct input in;
+	if (!input_open(&in, fd, framing, lines, MRZ_MAX_INPUT, start, end)) {
+		fprintf(stderr, "error: cannot seek in input\n");
+		return -1;
+	}
+	char *record;
+	size_t len;
+	int too_long;
+	while ((record = input_next(&in, &len, &too_long))) {
+		if (too_long) {
+			fprintf(stderr, "FAILED:\n%.*s...\n", 90,
+					state->ctx->pseudonymize ? "(withheld)" : record);
+			fprintf(stderr, "ERRORS:\n* record longer than %d bytes "
+					"or truncated\n", MRZ_MAX_INPUT);
+			return -1;
+		}
+		if (handle_record(state, record, len)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int parse_framing(const char *arg, int *framing, int *lines) {
+	static const struct {
+		const char *name;
+		int framing;
+	} modes[] = {
+		{"line", FRAMING_LINE},
+		{"lines", FRAMING_LINES},
+		{"blank", FRAMING_BLANK},
+		{"nul", FRAMING_NUL},
+		{"length", FRAMING_LENGTH},
+	};
+	*lines = 0;
+	if (!strncmp(arg, "lines:", 6)) {
+		*framing = FRAMING_LINES;
+		*lines = atoi(arg + 6);
+		return *lines > 0;
+	}
+	for (size_t i = 0; i < MRZ_ARRAY_SIZE(modes); ++i) {
+		if (!strcmp(arg, modes[i].name)) {
+			*framing = modes[i].framing;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Read everything into memory, find all MRZs in there and parse them
+// right from the text.
+static int parse_located(struct state *state, int fd) {
+	size_t cap = INPUT_BUFFER_SIZE;
+	size_t len = 0;
+	char *text = malloc(cap + 1);
+	for (;;) {
+		if (!text) {
+			fprintf(stderr, "error: out of memory\n");
+			return -1;
+		}
+		ssize_t n = read(fd, text + len, cap - len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			fprintf(stderr, "error: cannot read input\n");
+			free(text);
+			return -1;
+		} else if (n == 0) {
+			break;
+		}
+		len += n;
+		if (len == cap) {
+			char *grown = realloc(text, cap * 2 + 1);
+			if (!grown) {
+				free(text);
+			}
+			text = grown;
+			cap *= 2;
+		}
+	}
+	text[len] = 0;
+	int status = 0;
+	const char *p = text;
+	MRZ_LOCATION locations[64];
+	size_t n;
+	while (!status && (n = mrz_locate(p, text + len - p, locations,
+			MRZ_ARRAY_SIZE(locations))) > 0) {
+		for (size_t i = 0; i < n && !status; ++i) {
+			status = handle_record(state, locations[i].start,
+					locations[i].length);
+		}
+		p = locations[n - 1].start + locations[n - 1].length;
+	}
+	free(text);
+	return status;
+}
+
+static void usage(const char *bin) {
+	fprintf(stderr, "usage: %s [--utf8] [--print] [--store FILE] "
+			"[--columns FILE]\n"
+			"           [--pseudonymize KEYFILE] [--where FILTER] "
+			"[--framing MODE]\n"
+			"           [--shard I/N] [FILE]\n"
+			"       %s [OPTIONS] --locate [FILE] (without --utf8)\n"
+			"       %s [OPTIONS] [--queue-depth N] "
+			"(--files LIST | DIRECTORY)\n"
+			"       %s --merge FILE...\n"
+			"       %s [--utf8] [--pseudonymize KEYFILE] "
+			"[--where FILTER]\n"
+			"           [--framing MODE] [--workers N] "
+			"--serve (SOCKET | -)\n"
+			"\n"
+			"MODE is one of line (default), lines (detect lines per "
+			"record),\nlines:N, blank, nul or length (32 bit big endian "
+			"prefix)\n"
+			"KEYFILE holds a key of 32 hex digits\n"
+			"FILTER is a comma separated list of FIELD OP VALUE with OP "
+			"one of =, !=,\n<, <=, > or >=, where = and != take "
+			"alternatives like nationality=D|FRA\n",
+			bin, bin, bin, bin, bin);
+}
+
+int main(int argc, char **argv) {
+	MRZ_CONTEXT ctx;
+	mrz_context_init(&ctx);
+	struct state state = {&ctx, 0, {NULL, -1, NULL, 0}, NULL, {0}, NULL,
+			0};
+	MRZ_FILTER where;
+	unsigned char key[MRZ_PSEUDONYM_KEY_LENGTH];
+	const char *path = NULL;
+	const char *list = NULL;
+	long queue_depth = DEFAULT_QUEUE_DEPTH;
+	int locate = 0;
+	int framing = FRAMING_LINE;
+	int lines = 0;
+	const char *serve_path = NULL;
+	// sysconf() may fail or report more processors than we want threads.
+	long workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers < 1) {
+		workers = 1;
+	} else if (workers > MAX_WORKERS) {
+		workers = MAX_WORKERS;
+	}
+	long shard_index = 0;
+	long shard_count = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--store") && i + 1 < argc) {
+			state.store_path = argv[++i];
+		} else if (!strcmp(argv[i], "--columns") && i + 1 < argc) {
+			state.columns_path = argv[++i];
+		} else if (!strcmp(argv[i], "--pseudonymize") && i + 1 < argc) {
+			if (!read_key(argv[++i], key)) {
+				fprintf(stderr, "error: cannot read key from %s\n",
+						argv[i]);
+				return -1;
+			}
+			mrz_context_pseudonymize(&ctx, key);
+			memset(key, 0, sizeof(key));
+		} else if (!strcmp(argv[i], "--utf8")) {
+			mrz_context_utf8(&ctx, 1);
+		} else if (!strcmp(argv[i], "--where") && i + 1 < argc) {
+			if (!mrz_filter_compile(&where, argv[++i])) {
+				fprintf(stderr, "error: invalid filter %s\n", argv[i]);
+				return -1;
+			}
+			mrz_context_filter(&ctx, &where);
+		} else if (!strcmp(argv[i], "--print")) {
+			state.print = 1;
+		} else if (!strcmp(argv[i], "--framing") && i + 1 < argc) {
+			if (!parse_framing(argv[++i], &framing, &lines)) {
+				usage(*argv);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--locate")) {
+			locate = 1;
+		} else if (!strcmp(argv[i], "--files") && i + 1 < argc) {
+			list = argv[++i];
+		} else if (!strcmp(argv[i], "--queue-depth") && i + 1 < argc) {
+			queue_depth = atol(argv[++i]);
+			if (queue_depth < 1 || queue_depth > 4096) {
+				usage(*argv);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--shard") && i + 1 < argc) {
+			char c;
+			if (sscanf(argv[++i], "%ld/%ld%c", &shard_index,
+					&shard_count, &c) != 2 || shard_count < 1 ||
+					shard_index < 0 || shard_index >= shard_count) {
+				usage(*argv);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--serve") && i + 1 < argc) {
+			serve_path = argv[++i];
+		} else if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+			workers = atol(argv[++i]);
+			if (workers < 1 || workers > MAX_WORKERS) {
+				usage(*argv);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "--merge") && i + 1 < argc) {
+			return merge(argv + i + 1, argc - i - 1);
+		} else if (*argv[i] != '-' && !path) {
+			path = argv[i];
+		} else {
+			usage(*argv);
+			return -1;
+		}
+	}
+	if (serve_path) {
+		if (path || list || locate || shard_count > 0 || state.print ||
+				state.store_path || state.columns_path) {
+			usage(*argv);
+			return -1;
+		}
+		return serve(&state, serve_path, workers, framing, lines);
+	}
+	if (ctx.pseudonymize && state.store_path) {
+		// The store is keyed by document number, which is gone then.
+		fprintf(stderr, "error: cannot use --store with --pseudonymize\n");
+		return -1;
+	}
+	// mrz_locate() only picks lines in the MRZ alphabet, so it would
+	// never find what --utf8 is meant to map.
+	if (locate && ctx.utf8) {
+		usage(*argv);
+		return -1;
+	}
+	struct stat sb;
+	int is_dir = path && !stat(path, &sb) && S_ISDIR(sb.st_mode);
+	if ((list || is_dir) && (shard_count > 0 || locate || (list && path))) {
+		usage(*argv);
+		return -1;
+	}
+	int fd = STDIN_FILENO;
+	if (path && !is_dir && (fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, "error: cannot open %s\n", path);
+		return -1;
+	}
+	off_t start = 0;
+	off_t end = -1;
+	if (shard_count > 0 && (locate || framing == FRAMING_LINES ||
+			framing == FRAMING_LENGTH)) {
+		usage(*argv);
+		return -1;
+	} else if (shard_count > 0) {
+		// Split the file into N ranges that differ by one byte at most.
+		if (!path || fstat(fd, &sb) || !S_ISREG(sb.st_mode)) {
+			fprintf(stderr, "error: --shard needs a regular file\n");
+			close(fd);
+			return -1;
+		}
+		off_t size = sb.st_size;
+		off_t part = size / shard_count;
+		off_t rest = size % shard_count;
+		start = shard_index * part +
+				(shard_index < rest ? shard_index : rest);
+		end = start + part + (shard_index < rest);
+		printf("# shard %ld/%ld\n", shard_index, shard_count);
+	}
+	int status = 0;
+	if (state.store_path && !store_open(&state.st, state.store_path)) {
+		fprintf(stderr, "error: cannot open store %s\n",
+				state.store_path);
+		status = -1;
+	} else if (state.columns_path &&
+			!columns_open(&state.cols, state.columns_path)) {
+		fprintf(stderr, "error: cannot create %s\n", state.columns_path);
+		status = -1;
+	} else if (list || is_dir) {
+		size_t n;
+		char **paths = list
+			? batch_read_list(list, &n)
+			: batch_list_directory(path, &n);
+		if (!paths) {
+			fprintf(stderr, "error: cannot read %s\n", list ? list : path);
+			status = -1;
+		} else {
+			status = batch_read_files(paths, n, queue_depth,
+					MRZ_MAX_INPUT, handle_file, &state) ? -1 : 0;
+			batch_free_paths(paths, n);
+		}
+	} else if (locate) {
+		status = parse_located(&state, fd);
+	} else {
+		status = parse_stream(&state, fd, framing, lines, start, end);
+	}
+	store_close(&state.st);
+	if (!columns_close(&state.cols) && !status) {
+		fprintf(stderr, "error: cannot write %s\n", state.columns_path);
+		status = -1;
+	} else if (state.failed) {
+		status = -1;
+	}
+	if (path && !is_dir) {
+		close(fd);
+	}
+	return status;
+}
@@ -1,6 +1,9 @@
 #ifndef __mrzparser_h__
 #define __mrzparser_h__
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define MRZ_ERROR_DOCUMENT_CODE 1
 #define MRZ_ERROR_ISSUING_STATE 2
 #define MRZ_ERROR_DOCUMENT_NUMBER 3
@@ -34,6 +37,62 @@
 #define MRZ_ERROR_SWISS_VERSION 31
 #define MRZ_ERROR_SWISS_FILLER 32
 #define MRZ_MAX_ERRORS MRZ_ERROR_SWISS_FILLER
+// Bit of an error code in error_mask.
+#define MRZ_ERROR_BIT(code) ((uint64_t) 1 << ((code) - 1))
+
+// Fields of struct MRZ that have a status.
+#define MRZ_FIELD_DOCUMENT_CODE 0
+#define MRZ_FIELD_ISSUING_STATE 1
+#define MRZ_FIELD_PRIMARY_IDENTIFIER 2
+#define MRZ_FIELD_SECONDARY_IDENTIFIER 3
+#define MRZ_FIELD_NATIONALITY 4
+#define MRZ_FIELD_DOCUMENT_NUMBER 5
+#define MRZ_FIELD_DATE_OF_BIRTH 6
+#define MRZ_FIELD_SEX 7
+#define MRZ_FIELD_DATE_OF_EXPIRY 8
+#define MRZ_FIELD_OPTIONAL_DATA1 9
+#define MRZ_FIELD_OPTIONAL_DATA2 10
+#define MRZ_FIELD_BLANK_NUMBER 11
+#define MRZ_FIELD_LANGUAGE 12
+#define MRZ_FIELDS 13
+
+// Status of a field. A field is absent if it's empty or not part of
+// the MRZ. Check sums only fail if the field itself isn't malformed.
+#define MRZ_STATUS_ABSENT 0
+#define MRZ_STATUS_VALID 1
+#define MRZ_STATUS_MALFORMED 2
+#define MRZ_STATUS_CHECKSUM_FAILED 3
+
+// Maximum number of bytes parse_mrz() looks at. Longer input is
+// rejected without reading it any further. This is plenty for a MRZ
+// that is interspersed with white space and line breaks.
+#ifndef MRZ_MAX_INPUT
+#define MRZ_MAX_INPUT 1024
+#endif
+
+// A name field has no more than 45 characters and therefore no more
+// than 23 names.
+#define MRZ_MAX_NAMES 23
+
+struct MRZ_NAMES {
+	// Offset and length of every name in an identifier.
+	unsigned char offset[MRZ_MAX_NAMES];
+	unsigned char length[MRZ_MAX_NAMES];
+	int count;
+	// Set if the name field was completely filled, which means the
+	// name may have been truncated.
+	int truncated;
+};
+typedef struct MRZ_NAMES MRZ_NAMES;
+
+// Pseudonymized fields and the length of their tokens.
+#define MRZ_TOKEN_DOCUMENT_NUMBER 0
+#define MRZ_TOKEN_DATE_OF_BIRTH 1
+#define MRZ_TOKEN_PRIMARY_IDENTIFIER 2
+#define MRZ_TOKEN_SECONDARY_IDENTIFIER 3
+#define MRZ_TOKENS 4
+#define MRZ_TOKEN_LENGTH 16
+#define MRZ_PSEUDONYM_KEY_LENGTH 16
 
 struct MRZ {
 	char document_code[3];
@@ -49,11 +108,230 @@ struct MRZ {
 	char optional_data2[17];
 	char blank_number[7];
 	char language[4];
+	// Document number, date of birth and date of expiry as printed,
+	// each followed by its printed check digit, for BAC/PACE.
+	char bac_information[40];
+	// Both dates as printed, with fillers for unknown parts like in
+	// 74<<<<, which trimming would lose.
+	char printed_date_of_birth[7];
+	char printed_date_of_expiry[7];
+	// Error codes in the order they occurred, terminated by 0 if there
+	// are less than MRZ_MAX_ERRORS. Every code is listed only once.
 	int errors[MRZ_MAX_ERRORS];
+	// The same errors as bit mask, see MRZ_ERROR_BIT().
+	uint64_t error_mask;
+	// MRZ_STATUS_* of every MRZ_FIELD_*.
+	unsigned char status[MRZ_FIELDS];
+	int substitutions;
+	MRZ_NAMES primary_names;
+	MRZ_NAMES secondary_names;
+	// Keyed hashes of document number, date of birth and names if the
+	// MRZ was pseudonymized. Those fields are empty then.
+	int pseudonymized;
+	unsigned char tokens[MRZ_TOKENS][MRZ_TOKEN_LENGTH];
+	// Set if the MRZ doesn't match the filter it was parsed with. The
+	// parse functions return 0 then.
+	int rejected;
 };
 typedef struct MRZ MRZ;
 
 int parse_mrz(struct MRZ *, const char *);
+int parse_mrz_n(struct MRZ *, const char *, size_t);
+int parse_mrz_utf8(struct MRZ *, const char *);
+int parse_mrz_utf8_n(struct MRZ *, const char *, size_t);
+
+// Predicates of a filter, which compare a field of a struct MRZ with a
+// value. FIELD=A|B matches any of the given values.
+#define MRZ_FILTER_EQ 0
+#define MRZ_FILTER_NE 1
+#define MRZ_FILTER_LT 2
+#define MRZ_FILTER_LE 3
+#define MRZ_FILTER_GT 4
+#define MRZ_FILTER_GE 5
+#define MRZ_FILTER_MAX 16
+#define MRZ_FILTER_VALUE_MAX 64
+
+struct MRZ_PREDICATE {
+	// Offset of the field in struct MRZ.
+	size_t field;
+	int op;
+	// Index into the table of fields at fixed positions or -1.
+	int fixed;
+	// Two digit years up to pivot are 20YY and later ones 19YY if
+	// dates are compared by order, or -1. Set from the current year
+	// by mrz_filter_compile(): nobody is born in the future and no
+	// document expires more than 50 years from now.
+	int pivot;
+	char value[MRZ_FILTER_VALUE_MAX];
+};
+typedef struct MRZ_PREDICATE MRZ_PREDICATE;
+
+struct MRZ_FILTER {
+	int count;
+	MRZ_PREDICATE predicates[MRZ_FILTER_MAX];
+};
+typedef struct MRZ_FILTER MRZ_FILTER;
+
+int mrz_filter_compile(MRZ_FILTER *, const char *);
+int mrz_filter_match(const MRZ_FILTER *, const struct MRZ *);
+int parse_mrz_where(struct MRZ *, const char *, const MRZ_FILTER *);
+int parse_mrz_utf8_where(struct MRZ *, const char *, const MRZ_FILTER *);
+
+// A parser context that is reused for many calls by one thread. It
+// resets only what the previous call has set instead of the whole
+// struct MRZ. The result is in mrz.
+struct MRZ_CONTEXT {
+	struct MRZ mrz;
+	// Scratch buffer for the characters of the MRZ alphabet.
+	char pure[91];
+	// Set by mrz_context_pseudonymize().
+	int pseudonymize;
+	unsigned char key[MRZ_PSEUDONYM_KEY_LENGTH];
+	// Set by mrz_context_filter().
+	const MRZ_FILTER *filter;
+	// Set by mrz_context_utf8().
+	int utf8;
+};
+typedef struct MRZ_CONTEXT MRZ_CONTEXT;
+
+void mrz_context_init(MRZ_CONTEXT *);
+void mrz_context_pseudonymize(MRZ_CONTEXT *, const unsigned char *);
+void mrz_context_filter(MRZ_CONTEXT *, const MRZ_FILTER *);
+void mrz_context_utf8(MRZ_CONTEXT *, int);
+int parse_mrz_ctx(MRZ_CONTEXT *, const char *);
+int parse_mrz_ctx_n(MRZ_CONTEXT *, const char *, size_t);
+
+struct MRZ_LOCATION {
+	// First character of the first line.
+	const char *start;
+	// Number of bytes up to the last character of the last line.
+	size_t length;
+	int lines;
+};
+typedef struct MRZ_LOCATION MRZ_LOCATION;
+
+size_t mrz_locate(const char *, size_t, MRZ_LOCATION *, size_t);
+
+// Length of the MRZ information for BAC/PACE (document number, date of
+// birth and date of expiry, each followed by its check digit) for a
+// standard nine character document number.
+#define MRZ_BAC_INFORMATION_LENGTH 24
+#define MRZ_BAC_KSEED_LENGTH 16
+
+int mrz_bac_information(const struct MRZ *, char *, size_t);
+int mrz_bac_kseed(const struct MRZ *, unsigned char *);
+size_t mrz_bac_kseed_batch(const struct MRZ *, size_t,
+		unsigned char (*)[MRZ_BAC_KSEED_LENGTH]);
+
+void mrz_pseudonymize(struct MRZ *, const unsigned char *);
+size_t mrz_pseudonymize_batch(struct MRZ *, size_t, const unsigned char *);
+
+// Names in a watchlist index are truncated to this length, which is
+// still longer than any name field in a MRZ.
+#define MRZ_WATCHLIST_NAME_MAX 64
+
+struct MRZ_WATCHLIST_HIT {
+	uint32_t entry;
+	int distance;
+};
+typedef struct MRZ_WATCHLIST_HIT MRZ_WATCHLIST_HIT;
+
+void *mrz_watchlist_build(const char **, size_t, size_t *);
+int mrz_watchlist_check(const void *, size_t);
+// Queries are filtered by shared trigrams. A name needs more than three
+// distinct trigrams per allowed edit for that, so names of up to
+// 3 * max_distance - 2 characters (4 for a distance of 2) are compared
+// with every entry of the index instead.
+size_t mrz_watchlist_query(const void *, const struct MRZ *, int,
+		MRZ_WATCHLIST_HIT *, size_t);
+
+#define MRZ_STORE_EXISTS 0
+#define MRZ_STORE_INSERTED 1
+#define MRZ_STORE_FULL -1
+
+struct MRZ_STORE_RECORD {
+	uint64_t hash;
+	char issuing_state[4];
+	char document_number[46];
+	char document_code[3];
+	char nationality[4];
+	char date_of_birth[7];
+	char date_of_expiry[7];
+	char sex[2];
+	char primary_identifier[46];
+	char secondary_identifier[46];
+};
+typedef struct MRZ_STORE_RECORD MRZ_STORE_RECORD;
+
+size_t mrz_store_size(uint64_t);
+void mrz_store_init(void *, uint64_t);
+int mrz_store_check(const void *, size_t);
+uint64_t mrz_store_count(const void *);
+const MRZ_STORE_RECORD *mrz_store_find(const void *, const char *,
+		const char *);
+int mrz_store_insert(void *, const struct MRZ *);
+int mrz_store_grow(void *, const void *);
+
+// Columns of a columnar file. Strings are padded with zeros to the
+// capacity of their field and are only null-terminated if shorter.
+#define MRZ_COLUMN_DOCUMENT_CODE MRZ_FIELD_DOCUMENT_CODE
+#define MRZ_COLUMN_ISSUING_STATE MRZ_FIELD_ISSUING_STATE
+#define MRZ_COLUMN_PRIMARY_IDENTIFIER MRZ_FIELD_PRIMARY_IDENTIFIER
+#define MRZ_COLUMN_SECONDARY_IDENTIFIER MRZ_FIELD_SECONDARY_IDENTIFIER
+#define MRZ_COLUMN_NATIONALITY MRZ_FIELD_NATIONALITY
+#define MRZ_COLUMN_DOCUMENT_NUMBER MRZ_FIELD_DOCUMENT_NUMBER
+#define MRZ_COLUMN_DATE_OF_BIRTH MRZ_FIELD_DATE_OF_BIRTH
+#define MRZ_COLUMN_SEX MRZ_FIELD_SEX
+#define MRZ_COLUMN_DATE_OF_EXPIRY MRZ_FIELD_DATE_OF_EXPIRY
+#define MRZ_COLUMN_OPTIONAL_DATA1 MRZ_FIELD_OPTIONAL_DATA1
+#define MRZ_COLUMN_OPTIONAL_DATA2 MRZ_FIELD_OPTIONAL_DATA2
+#define MRZ_COLUMN_BLANK_NUMBER MRZ_FIELD_BLANK_NUMBER
+#define MRZ_COLUMN_LANGUAGE MRZ_FIELD_LANGUAGE
+// One bit per error code, bit 0 for code 1.
+#define MRZ_COLUMN_ERRORS MRZ_FIELDS
+// MRZ_TOKENS tokens of MRZ_TOKEN_LENGTH bytes, all zero if the MRZ
+// wasn't pseudonymized.
+#define MRZ_COLUMN_TOKENS (MRZ_FIELDS + 1)
+#define MRZ_COLUMN_COUNT (MRZ_FIELDS + 2)
+
+// Dates are stored as int32_t YYMMDD, with unknown parts set to 0, or
+// as MRZ_COLUMNS_NO_DATE if there is no date at all.
+#define MRZ_COLUMNS_NO_DATE -1
+
+struct MRZ_COLUMNS {
+	const unsigned char *data;
+	uint64_t groups;
+	uint64_t rows;
+	const uint64_t *index;
+};
+typedef struct MRZ_COLUMNS MRZ_COLUMNS;
+
+struct MRZ_COLUMNS_CURSOR {
+	const MRZ_COLUMNS *columns;
+	uint64_t group;
+	uint64_t rows;
+	// Row in the current group, which starts before the first row.
+	uint64_t row;
+	const unsigned char *blocks[MRZ_COLUMN_COUNT];
+};
+typedef struct MRZ_COLUMNS_CURSOR MRZ_COLUMNS_CURSOR;
+
+size_t mrz_columns_width(int);
+size_t mrz_columns_header(void *);
+size_t mrz_columns_group_size(uint64_t);
+void mrz_columns_group(void *, const struct MRZ *, uint64_t);
+size_t mrz_columns_footer_size(uint64_t);
+void mrz_columns_footer(void *, const uint64_t *, const uint64_t *,
+		uint64_t);
+int mrz_columns_open(MRZ_COLUMNS *, const void *, size_t);
+const void *mrz_columns_block(const MRZ_COLUMNS *, uint64_t, int,
+		uint64_t *);
+void mrz_columns_cursor(MRZ_COLUMNS_CURSOR *, const MRZ_COLUMNS *);
+int mrz_columns_next(MRZ_COLUMNS_CURSOR *);
+const char *mrz_columns_string(const MRZ_COLUMNS_CURSOR *, int, size_t *);
+int32_t mrz_columns_date(const MRZ_COLUMNS_CURSOR *, int);
+uint64_t mrz_columns_errors(const MRZ_COLUMNS_CURSOR *);
+const unsigned char *mrz_columns_token(const MRZ_COLUMNS_CURSOR *, int);
 
 const char *mrz_error_string(int code) {
 	switch (code) {
@@ -98,35 +376,86 @@ const char *mrz_error_string(int code) {
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-#define MRZ_CHARACTERS "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-#define MRZ_NUMBERS "0123456789"
 #define MRZ_FILLER "<"
-#define MRZ_SEXES "MFX" MRZ_FILLER
-#define MRZ_ALL MRZ_CHARACTERS MRZ_NUMBERS MRZ_FILLER
-#define MRZ_CHARACTERS_AND_FILLER MRZ_CHARACTERS MRZ_FILLER
-#define MRZ_NUMBERS_AND_FILLER MRZ_NUMBERS MRZ_FILLER
 #define MRZ_CAPACITY(s) (sizeof(s) - 1)
 #define MRZ_ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 #define MRZ_FILLER_SEPARATOR "<<"
 #define MRZ_WHITE_SPACE " "
 
-static void mrz_add_error(int *error, int code) {
-	for (int *end = error + MRZ_MAX_ERRORS; error < end; ++error) {
-		if (!*error) {
-			*error = code;
-			break;
-		}
+// Character classes of the MRZ alphabet.
+#define MRZ_CLASS_CHARACTER 1
+#define MRZ_CLASS_NUMBER 2
+#define MRZ_CLASS_FILLER 4
+#define MRZ_CLASS_SEX 8
+#define MRZ_CLASS_ALL (MRZ_CLASS_CHARACTER | MRZ_CLASS_NUMBER | \
+		MRZ_CLASS_FILLER)
+#define MRZ_CLASS_CHARACTER_OR_FILLER (MRZ_CLASS_CHARACTER | \
+		MRZ_CLASS_FILLER)
+#define MRZ_CLASS_NUMBER_OR_FILLER (MRZ_CLASS_NUMBER | MRZ_CLASS_FILLER)
+#define MRZ_CLASS_SEX_OR_FILLER (MRZ_CLASS_SEX | MRZ_CLASS_FILLER)
+#define MRZ_C MRZ_CLASS_CHARACTER
+#define MRZ_N MRZ_CLASS_NUMBER
+#define MRZ_S MRZ_CLASS_SEX
+static const unsigned char mrz_classes[256] = {
+	['A'] = MRZ_C, ['B'] = MRZ_C, ['C'] = MRZ_C, ['D'] = MRZ_C,
+	['E'] = MRZ_C, ['F'] = MRZ_C | MRZ_S, ['G'] = MRZ_C, ['H'] = MRZ_C,
+	['I'] = MRZ_C, ['J'] = MRZ_C, ['K'] = MRZ_C, ['L'] = MRZ_C,
+	['M'] = MRZ_C | MRZ_S, ['N'] = MRZ_C, ['O'] = MRZ_C, ['P'] = MRZ_C,
+	['Q'] = MRZ_C, ['R'] = MRZ_C, ['S'] = MRZ_C, ['T'] = MRZ_C,
+	['U'] = MRZ_C, ['V'] = MRZ_C, ['W'] = MRZ_C, ['X'] = MRZ_C | MRZ_S,
+	['Y'] = MRZ_C, ['Z'] = MRZ_C,
+	['0'] = MRZ_N, ['1'] = MRZ_N, ['2'] = MRZ_N, ['3'] = MRZ_N,
+	['4'] = MRZ_N, ['5'] = MRZ_N, ['6'] = MRZ_N, ['7'] = MRZ_N,
+	['8'] = MRZ_N, ['9'] = MRZ_N,
+	['<'] = MRZ_CLASS_FILLER,
+};
+#undef MRZ_C
+#undef MRZ_N
+#undef MRZ_S
+
+static int mrz_popcount(uint64_t x) {
+	x -= (x >> 1) & 0x5555555555555555;
+	x = (x & 0x3333333333333333) + ((x >> 2) & 0x3333333333333333);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0f;
+	return (int) ((x * 0x0101010101010101) >> 56);
+}
+
+static void mrz_add_error(MRZ *mrz, int code) {
+	uint64_t bit = MRZ_ERROR_BIT(code);
+	if (!(mrz->error_mask & bit)) {
+		// Codes are listed only once, so the number of bits set is
+		// the number of codes in the list.
+		mrz->errors[mrz_popcount(mrz->error_mask)] = code;
+		mrz->error_mask |= bit;
 	}
 }
 
 static int mrz_assert_checksum(int result, MRZ *mrz, int code) {
 	if (!result) {
-		mrz_add_error(mrz->errors, code);
+		mrz_add_error(mrz, code);
 	}
 	return result;
 }
 
+// Value of every character of the MRZ alphabet plus one, so invalid
+// characters are 0.
+static const unsigned char mrz_values[256] = {
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15,
+	['F'] = 16, ['G'] = 17, ['H'] = 18, ['I'] = 19, ['J'] = 20,
+	['K'] = 21, ['L'] = 22, ['M'] = 23, ['N'] = 24, ['O'] = 25,
+	['P'] = 26, ['Q'] = 27, ['R'] = 28, ['S'] = 29, ['T'] = 30,
+	['U'] = 31, ['V'] = 32, ['W'] = 33, ['X'] = 34, ['Y'] = 35,
+	['Z'] = 36, ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4,
+	['4'] = 5, ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9,
+	['9'] = 10, ['<'] = 1,
+};
+
+static int mrz_char_value(char c) {
+	return mrz_values[(unsigned char) c] - 1;
+}
+
 static int mrz_check_digit_weights[] = {7, 3, 1};
 static int mrz_check(const char *digit, ...) {
 	if (!digit) {
@@ -135,25 +464,20 @@ static int mrz_check(const char *digit, ...) {
 	va_list ap;
 	va_start(ap, digit);
 	int sum = 0;
-	int i = 0;
+	int w = 0;
 	for (;;) {
 		const char *s = va_arg(ap, char *);
 		if (!s) {
 			break;
 		}
-		for (; *s; ++s, ++i) {
-			char c = *s;
-			if (c > 64 && c < 91) {
-				c -= 55; // Map A-Z to 10-35.
-			} else if (c > 47 && c < 58) {
-				c -= 48; // Use number value.
-			} else if (c == 60) {
-				c = 0; // '<' is 0.
-			} else {
+		for (; *s; ++s) {
+			int c = mrz_char_value(*s);
+			if (c < 0) {
 				va_end(ap);
 				return 0; // Invalid character.
 			}
-			sum += c * mrz_check_digit_weights[i % 3];
+			sum += c * mrz_check_digit_weights[w];
+			w = w < 2 ? w + 1 : 0;
 		}
 	}
 	sum %= 10;
@@ -226,33 +550,127 @@ static void mrz_replace_fillers(char *s) {
 	}
 }
 
+// Copy the names from s to dst up to the end of s or, if stop is set,
+// up to the first separator. Fillers at both ends are dropped and all
+// others are replaced with white space. Records every name on the way.
+// Returns the position after the separator or NULL if there is none.
+static const char *mrz_copy_names(char *dst, size_t cap, MRZ_NAMES *names,
+		const char *s, int stop) {
+	size_t n = 0;
+	size_t len = 0;
+	names->count = 0;
+	for (; *s; ++s) {
+		if (*s == *MRZ_FILLER) {
+			if (stop && s[1] == *MRZ_FILLER) {
+				dst[len] = 0;
+				return s + 2;
+			}
+			if (n > 0 && n < cap) {
+				dst[n++] = *MRZ_WHITE_SPACE;
+			}
+			continue;
+		}
+		if (n >= cap) {
+			continue;
+		}
+		if ((n == 0 || dst[n - 1] == *MRZ_WHITE_SPACE) &&
+				names->count < MRZ_MAX_NAMES) {
+			names->offset[names->count] = n;
+			names->length[names->count++] = 0;
+		}
+		dst[n++] = *s;
+		++names->length[names->count - 1];
+		len = n;
+	}
+	dst[len] = 0;
+	return NULL;
+}
+
+// A full name field may have been cut off.
+static int mrz_names_truncated(const char *field) {
+	size_t len = strlen(field);
+	return len > 0 && field[len - 1] != *MRZ_FILLER;
+}
+
 static void mrz_parse_identifiers(MRZ *mrz, const char *identifiers) {
-	const char *p = strstr(identifiers, MRZ_FILLER_SEPARATOR);
-	size_t cap = MRZ_CAPACITY(mrz->primary_identifier);
-	size_t len = p - identifiers;
-	if (p && len < cap) {
-		cap = len;
-		strncpy(mrz->secondary_identifier, p + 2,
-				MRZ_CAPACITY(mrz->secondary_identifier));
-		mrz_trim_fillers(mrz->secondary_identifier);
-		mrz_replace_fillers(mrz->secondary_identifier);
+	const char *p = mrz_copy_names(mrz->primary_identifier,
+			MRZ_CAPACITY(mrz->primary_identifier), &mrz->primary_names,
+			identifiers, 1);
+	if (p) {
+		mrz_copy_names(mrz->secondary_identifier,
+				MRZ_CAPACITY(mrz->secondary_identifier),
+				&mrz->secondary_names, p, 0);
+	}
+	(p ? &mrz->secondary_names : &mrz->primary_names)->truncated =
+			mrz_names_truncated(identifiers);
+}
+
+// Keep document number, date of birth and date of expiry as printed,
+// each followed by its printed check digit, because that's what the
+// chip expects (ICAO 9303p11, 9.7.2). Must be called before fields
+// are expanded or trimmed. An extended document number continues in
+// ext up to its check digit.
+static void mrz_keep_bac_information(MRZ *mrz, const char *dn_digit,
+		const char *ext, const char *dob_digit, const char *doe_digit) {
+	char *info = mrz->bac_information;
+	*info = 0;
+	size_t len = strlen(mrz->document_number);
+	if (len != 9 || strlen(mrz->date_of_birth) != 6 ||
+			strlen(mrz->date_of_expiry) != 6 ||
+			!*dn_digit || !*dob_digit || !*doe_digit) {
+		return;
+	}
+	char *p = info;
+	memcpy(p, mrz->document_number, len);
+	p += len;
+	const char *q;
+	if (*dn_digit == *MRZ_FILLER && ext &&
+			(q = strchr(ext, *MRZ_FILLER)) && q - ext > 1) {
+		// Like mrz_check_and_expand_extended_document_number(), keep
+		// the filler only if the issuer included it in the check.
+		size_t n = q - ext - 1;
+		char digit[2] = {ext[n], 0};
+		char with[26];
+		memcpy(with, info, len);
+		with[len] = *MRZ_FILLER;
+		memcpy(with + len + 1, ext, n);
+		with[len + 1 + n] = 0;
+		memcpy(p, ext, n);
+		p[n] = 0;
+		if (!mrz_check(digit, info, NULL) && mrz_check(digit, with, NULL)) {
+			memcpy(info, with, len + 1 + n);
+			++p;
+		}
+		p += n;
+		*p++ = *digit;
+	} else {
+		*p++ = *dn_digit;
 	}
-	strncpy(mrz->primary_identifier, identifiers, cap);
-	mrz_trim_fillers(mrz->primary_identifier);
-	mrz_replace_fillers(mrz->primary_identifier);
+	memcpy(p, mrz->date_of_birth, 6);
+	p += 6;
+	*p++ = *dob_digit;
+	memcpy(p, mrz->date_of_expiry, 6);
+	p += 6;
+	*p++ = *doe_digit;
+	*p = 0;
 }
 
 static int mrz_parse_component(const char **src, size_t size, char *field,
-		size_t len, const char *allowed,
-		int error_code, int *errors) {
+		size_t len, int allowed,
+		int error_code, MRZ *mrz) {
 	if (!**src || size < len) {
 		return 0;
 	}
-	int invalid = strspn(*src, allowed) < len;
-	if (invalid) {
-		mrz_add_error(errors, error_code);
+	const char *s = *src;
+	size_t i = 0;
+	int invalid = 0;
+	for (; i < len && s[i]; ++i) {
+		invalid |= !(mrz_classes[(unsigned char) s[i]] & allowed);
+	}
+	if (i < len || invalid) {
+		mrz_add_error(mrz, error_code);
 		// Check premature end of input.
-		if (strlen(*src) < len) {
+		if (i < len) {
 			// Move to the end of the string to make sure all
 			// subsequent calls to mrz_parse_component() will fail, too.
 			for (; **src; ++*src);
@@ -260,83 +678,87 @@ static int mrz_parse_component(const char **src, size_t size, char *field,
 		}
 		// Otherwise take malformed component and keep parsing.
 	}
-	strncpy(field, *src, len);
+	memcpy(field, s, len);
+	field[len] = 0;
 	*src += len;
 	return invalid ^ 1;
 }
 
 static int mrz_parse_td1(MRZ *mrz, const char *s) {
-	int *e = mrz->errors;
 	int success = 1;
 
 	// First line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_code), mrz->document_code,
-			2, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_CODE, e);
+			2, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_CODE, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->issuing_state), mrz->issuing_state,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_ISSUING_STATE, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_ISSUING_STATE, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_number), mrz->document_number,
-			9, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_NUMBER, e);
+			9, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_NUMBER, mrz);
 	char document_number_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(document_number_check_digit), document_number_check_digit,
-			1, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->optional_data1), mrz->optional_data1,
-			15, MRZ_ALL,
-			MRZ_ERROR_OPTIONAL_DATA1, e);
+			15, MRZ_CLASS_ALL,
+			MRZ_ERROR_OPTIONAL_DATA1, mrz);
 
 	// Second line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_birth), mrz->date_of_birth,
-			6, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DATE_OF_BIRTH, e);
+			6, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DATE_OF_BIRTH, mrz);
 	char date_of_birth_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(date_of_birth_check_digit), date_of_birth_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->sex), mrz->sex,
-			1, MRZ_SEXES,
-			MRZ_ERROR_SEX, e);
+			1, MRZ_CLASS_SEX_OR_FILLER,
+			MRZ_ERROR_SEX, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_expiry), mrz->date_of_expiry,
-			6, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_EXPIRY, e);
+			6, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_EXPIRY, mrz);
 	char date_of_expiry_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(date_of_expiry_check_digit), date_of_expiry_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_EXPIRY_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_EXPIRY_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->nationality), mrz->nationality,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_NATIONALITY, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_NATIONALITY, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->optional_data2), mrz->optional_data2,
-			11, MRZ_ALL,
-			MRZ_ERROR_OPTIONAL_DATA2, e);
+			11, MRZ_CLASS_ALL,
+			MRZ_ERROR_OPTIONAL_DATA2, mrz);
 	char check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(check_digit), check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_COMBINED_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_COMBINED_CHECK_DIGIT, mrz);
 
 	// Third line.
 	char identifiers[31] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(identifiers), identifiers,
-			30, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_IDENTIFIERS, e);
+			30, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_IDENTIFIERS, mrz);
 	mrz_parse_identifiers(mrz, identifiers);
 
+	mrz_keep_bac_information(mrz, document_number_check_digit,
+			mrz->optional_data1, date_of_birth_check_digit,
+			date_of_expiry_check_digit);
+
 	// Validate check sums.
 	success &= mrz_assert_checksum(
 			mrz_check(check_digit,
@@ -368,9 +790,8 @@ static int mrz_parse_td1(MRZ *mrz, const char *s) {
 }
 
 static int mrz_parse_td2(MRZ *mrz, const char *s) {
-	int *e = mrz->errors;
 	if (*s == 'V') {
-		mrz_add_error(e, MRZ_ERROR_VISA);
+		mrz_add_error(mrz, MRZ_ERROR_VISA);
 		return 0;
 	}
 	int success = 1;
@@ -378,64 +799,68 @@ static int mrz_parse_td2(MRZ *mrz, const char *s) {
 	// First line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_code), mrz->document_code,
-			2, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_CODE, e);
+			2, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_CODE, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->issuing_state), mrz->issuing_state,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_ISSUING_STATE, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_ISSUING_STATE, mrz);
 	char identifiers[32] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(identifiers), identifiers,
-			31, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_IDENTIFIERS, e);
+			31, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_IDENTIFIERS, mrz);
 	mrz_parse_identifiers(mrz, identifiers);
 
 	// Second line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_number), mrz->document_number,
-			9, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_NUMBER, e);
+			9, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_NUMBER, mrz);
 	char document_number_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(document_number_check_digit), document_number_check_digit,
-			1, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->nationality), mrz->nationality,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_NATIONALITY, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_NATIONALITY, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_birth), mrz->date_of_birth,
-			6, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DATE_OF_BIRTH, e);
+			6, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DATE_OF_BIRTH, mrz);
 	char date_of_birth_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(date_of_birth_check_digit), date_of_birth_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->sex), mrz->sex,
-			1, MRZ_SEXES,
-			MRZ_ERROR_SEX, e);
+			1, MRZ_CLASS_SEX_OR_FILLER,
+			MRZ_ERROR_SEX, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_expiry), mrz->date_of_expiry,
-			6, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_EXPIRY, e);
+			6, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_EXPIRY, mrz);
 	char date_of_expiry_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(date_of_expiry_check_digit), date_of_expiry_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_EXPIRY_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_EXPIRY_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->optional_data2), mrz->optional_data2,
-			7, MRZ_ALL,
-			MRZ_ERROR_OPTIONAL_DATA2, e);
+			7, MRZ_CLASS_ALL,
+			MRZ_ERROR_OPTIONAL_DATA2, mrz);
 	char check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(check_digit), check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_COMBINED_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_COMBINED_CHECK_DIGIT, mrz);
+
+	mrz_keep_bac_information(mrz, document_number_check_digit,
+			mrz->optional_data2, date_of_birth_check_digit,
+			date_of_expiry_check_digit);
 
 	// Validate check sums.
 	success &= mrz_assert_checksum(
@@ -467,9 +892,8 @@ static int mrz_parse_td2(MRZ *mrz, const char *s) {
 }
 
 static int mrz_parse_td3(MRZ *mrz, const char *s) {
-	int *e = mrz->errors;
 	if (*s == 'V') {
-		mrz_add_error(e, MRZ_ERROR_VISA);
+		mrz_add_error(mrz, MRZ_ERROR_VISA);
 		return 0;
 	}
 	int success = 1;
@@ -477,70 +901,74 @@ static int mrz_parse_td3(MRZ *mrz, const char *s) {
 	// First line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_code), mrz->document_code,
-			2, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_CODE, e);
+			2, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_CODE, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->issuing_state), mrz->issuing_state,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_ISSUING_STATE, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_ISSUING_STATE, mrz);
 	char identifiers[40] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(identifiers), identifiers,
-			39, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_IDENTIFIERS, e);
+			39, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_IDENTIFIERS, mrz);
 	mrz_parse_identifiers(mrz, identifiers);
 
 	// Second line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_number), mrz->document_number,
-			9, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_NUMBER, e);
+			9, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_NUMBER, mrz);
 	char document_number_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(document_number_check_digit), document_number_check_digit,
-			1, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->nationality), mrz->nationality,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_NATIONALITY, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_NATIONALITY, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_birth), mrz->date_of_birth,
-			6, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DATE_OF_BIRTH, e);
+			6, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DATE_OF_BIRTH, mrz);
 	char date_of_birth_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(date_of_birth_check_digit), date_of_birth_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->sex), mrz->sex,
-			1, MRZ_SEXES,
-			MRZ_ERROR_SEX, e);
+			1, MRZ_CLASS_SEX_OR_FILLER,
+			MRZ_ERROR_SEX, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_expiry), mrz->date_of_expiry,
-			6, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_EXPIRY, e);
+			6, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_EXPIRY, mrz);
 	char date_of_expiry_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(date_of_expiry_check_digit), date_of_expiry_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_EXPIRY_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_EXPIRY_CHECK_DIGIT, mrz);
 	char personal_number[15] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(personal_number), personal_number,
-			14, MRZ_ALL,
-			MRZ_ERROR_PERSONAL_NUMBER, e);
+			14, MRZ_CLASS_ALL,
+			MRZ_ERROR_PERSONAL_NUMBER, mrz);
 	char personal_number_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(personal_number_check_digit), personal_number_check_digit,
-			1, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_PERSONAL_NUMBER_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_PERSONAL_NUMBER_CHECK_DIGIT, mrz);
 	char check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(check_digit), check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_COMBINED_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_COMBINED_CHECK_DIGIT, mrz);
+
+	mrz_keep_bac_information(mrz, document_number_check_digit,
+			NULL, date_of_birth_check_digit,
+			date_of_expiry_check_digit);
 
 	// Validate check sums.
 	success &= mrz_assert_checksum(
@@ -572,9 +1000,8 @@ static int mrz_parse_td3(MRZ *mrz, const char *s) {
 }
 
 static int mrz_parse_mrva(MRZ *mrz, const char *s) {
-	int *e = mrz->errors;
 	if (*s != 'V') {
-		mrz_add_error(e, MRZ_ERROR_NO_VISA);
+		mrz_add_error(mrz, MRZ_ERROR_NO_VISA);
 		return 0;
 	}
 	int success = 1;
@@ -582,59 +1009,63 @@ static int mrz_parse_mrva(MRZ *mrz, const char *s) {
 	// First line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_code), mrz->document_code,
-			2, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_CODE, e);
+			2, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_CODE, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->issuing_state), mrz->issuing_state,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_ISSUING_STATE, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_ISSUING_STATE, mrz);
 	char identifiers[40] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(identifiers), identifiers,
-			39, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_IDENTIFIERS, e);
+			39, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_IDENTIFIERS, mrz);
 	mrz_parse_identifiers(mrz, identifiers);
 
 	// Second line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_number), mrz->document_number,
-			9, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_NUMBER, e);
+			9, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_NUMBER, mrz);
 	char document_number_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(document_number_check_digit), document_number_check_digit,
-			1, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->nationality), mrz->nationality,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_NATIONALITY, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_NATIONALITY, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_birth), mrz->date_of_birth,
-			6, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DATE_OF_BIRTH, e);
+			6, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DATE_OF_BIRTH, mrz);
 	char date_of_birth_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(date_of_birth_check_digit), date_of_birth_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->sex), mrz->sex,
-			1, MRZ_SEXES,
-			MRZ_ERROR_SEX, e);
+			1, MRZ_CLASS_SEX_OR_FILLER,
+			MRZ_ERROR_SEX, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_expiry), mrz->date_of_expiry,
-			6, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_EXPIRY, e);
+			6, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_EXPIRY, mrz);
 	char date_of_expiry_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(date_of_expiry_check_digit), date_of_expiry_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_EXPIRY_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_EXPIRY_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->optional_data2), mrz->optional_data2,
-			16, MRZ_ALL,
-			MRZ_ERROR_OPTIONAL_DATA2, e);
+			16, MRZ_CLASS_ALL,
+			MRZ_ERROR_OPTIONAL_DATA2, mrz);
+
+	mrz_keep_bac_information(mrz, document_number_check_digit,
+			NULL, date_of_birth_check_digit,
+			date_of_expiry_check_digit);
 
 	// Validate check sums.
 	success &= mrz_assert_checksum(
@@ -651,9 +1082,8 @@ static int mrz_parse_mrva(MRZ *mrz, const char *s) {
 }
 
 static int mrz_parse_mrvb(MRZ *mrz, const char *s) {
-	int *e = mrz->errors;
 	if (*s != 'V') {
-		mrz_add_error(e, MRZ_ERROR_NO_VISA);
+		mrz_add_error(mrz, MRZ_ERROR_NO_VISA);
 		return 0;
 	}
 	int success = 1;
@@ -661,59 +1091,63 @@ static int mrz_parse_mrvb(MRZ *mrz, const char *s) {
 	// First line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_code), mrz->document_code,
-			2, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_CODE, e);
+			2, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_CODE, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->issuing_state), mrz->issuing_state,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_ISSUING_STATE, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_ISSUING_STATE, mrz);
 	char identifiers[32] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(identifiers), identifiers,
-			31, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_IDENTIFIERS, e);
+			31, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_IDENTIFIERS, mrz);
 	mrz_parse_identifiers(mrz, identifiers);
 
 	// Second line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_number), mrz->document_number,
-			9, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_NUMBER, e);
+			9, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_NUMBER, mrz);
 	char document_number_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(document_number_check_digit), document_number_check_digit,
-			1, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->nationality), mrz->nationality,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_NATIONALITY, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_NATIONALITY, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_birth), mrz->date_of_birth,
-			6, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DATE_OF_BIRTH, e);
+			6, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DATE_OF_BIRTH, mrz);
 	char date_of_birth_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(date_of_birth_check_digit), date_of_birth_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->sex), mrz->sex,
-			1, MRZ_SEXES,
-			MRZ_ERROR_SEX, e);
+			1, MRZ_CLASS_SEX_OR_FILLER,
+			MRZ_ERROR_SEX, mrz);
 	char date_of_expiry_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_expiry), mrz->date_of_expiry,
-			6, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_EXPIRY, e);
+			6, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_EXPIRY, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(date_of_expiry_check_digit), date_of_expiry_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_EXPIRY_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_EXPIRY_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->optional_data2), mrz->optional_data2,
-			8, MRZ_ALL,
-			MRZ_ERROR_OPTIONAL_DATA2, e);
+			8, MRZ_CLASS_ALL,
+			MRZ_ERROR_OPTIONAL_DATA2, mrz);
+
+	mrz_keep_bac_information(mrz, document_number_check_digit,
+			NULL, date_of_birth_check_digit,
+			date_of_expiry_check_digit);
 
 	// Validate check sums.
 	success &= mrz_assert_checksum(
@@ -732,80 +1166,79 @@ static int mrz_parse_mrvb(MRZ *mrz, const char *s) {
 static int mrz_parse_france(MRZ *mrz, const char *s) {
 	// France got its very own MRZ on ID cards:
 	// https://en.wikipedia.org/wiki/National_identity_card_(France)
-	int *e = mrz->errors;
 	int success = 1;
 
 	// First line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_code), mrz->document_code,
-			2, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_CODE, e);
+			2, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_CODE, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->nationality), mrz->nationality,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_NATIONALITY, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_NATIONALITY, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->primary_identifier), mrz->primary_identifier,
-			25, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_IDENTIFIERS, e);
+			25, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_IDENTIFIERS, mrz);
 	char department_of_issuance1[4] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(department_of_issuance1), department_of_issuance1,
-			3, MRZ_ALL,
-			MRZ_ERROR_DEPARTMENT_OF_ISSUANCE, e);
+			3, MRZ_CLASS_ALL,
+			MRZ_ERROR_DEPARTMENT_OF_ISSUANCE, mrz);
 	char office_of_issuance[4] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(office_of_issuance), office_of_issuance,
-			3, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_OFFICE_OF_ISSUANCE, e);
+			3, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_OFFICE_OF_ISSUANCE, mrz);
 
 	// Second line.
 	char year_of_issuance[3] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(year_of_issuance), year_of_issuance,
-			2, MRZ_NUMBERS,
-			MRZ_ERROR_YEAR_OF_ISSUANCE, e);
+			2, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_YEAR_OF_ISSUANCE, mrz);
 	char month_of_issuance[3] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(month_of_issuance), month_of_issuance,
-			2, MRZ_NUMBERS,
-			MRZ_ERROR_MONTH_OF_ISSUANCE, e);
+			2, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_MONTH_OF_ISSUANCE, mrz);
 	char department_of_issuance2[4] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(department_of_issuance2), department_of_issuance2,
-			3, MRZ_ALL,
-			MRZ_ERROR_DEPARTMENT_OF_ISSUANCE, e);
+			3, MRZ_CLASS_ALL,
+			MRZ_ERROR_DEPARTMENT_OF_ISSUANCE, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_number), mrz->document_number,
-			5, MRZ_NUMBERS,
-			MRZ_ERROR_DOCUMENT_NUMBER, e);
+			5, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DOCUMENT_NUMBER, mrz);
 	char document_number_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(document_number_check_digit), document_number_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DOCUMENT_NUMBER_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->secondary_identifier), mrz->secondary_identifier,
-			14, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_IDENTIFIERS, e);
+			14, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_IDENTIFIERS, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_birth), mrz->date_of_birth,
-			6, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DATE_OF_BIRTH, e);
+			6, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DATE_OF_BIRTH, mrz);
 	char date_of_birth_check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(date_of_birth_check_digit), date_of_birth_check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_DATE_OF_BIRTH_CHECK_DIGIT, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->sex), mrz->sex,
-			1, MRZ_SEXES,
-			MRZ_ERROR_SEX, e);
+			1, MRZ_CLASS_SEX_OR_FILLER,
+			MRZ_ERROR_SEX, mrz);
 	char check_digit[2] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(check_digit), check_digit,
-			1, MRZ_NUMBERS,
-			MRZ_ERROR_COMBINED_CHECK_DIGIT, e);
+			1, MRZ_CLASS_NUMBER,
+			MRZ_ERROR_COMBINED_CHECK_DIGIT, mrz);
 
 	// Validate check sums.
 	success &= mrz_assert_checksum(
@@ -849,10 +1282,19 @@ static int mrz_parse_france(MRZ *mrz, const char *s) {
 			(year + (year < 14 || year > 50 ? 10 : 15)) % 100,
 			month_of_issuance);
 
-	// Trim identifiers as we do this with other MRZs too. This cannot
-	// be done before calculating the combined checksum, of course.
-	mrz_trim_fillers(mrz->primary_identifier);
-	mrz_trim_fillers(mrz->secondary_identifier);
+	// Trim identifiers and replace fillers as we do this with other
+	// MRZs too. This cannot be done before calculating the combined
+	// checksum, of course.
+	mrz->primary_names.truncated =
+			mrz_names_truncated(mrz->primary_identifier);
+	mrz->secondary_names.truncated =
+			mrz_names_truncated(mrz->secondary_identifier);
+	mrz_copy_names(mrz->primary_identifier,
+			MRZ_CAPACITY(mrz->primary_identifier), &mrz->primary_names,
+			mrz->primary_identifier, 0);
+	mrz_copy_names(mrz->secondary_identifier,
+			MRZ_CAPACITY(mrz->secondary_identifier),
+			&mrz->secondary_names, mrz->secondary_identifier, 0);
 
 	return success;
 }
@@ -860,34 +1302,33 @@ static int mrz_parse_france(MRZ *mrz, const char *s) {
 static int mrz_parse_dl_swiss(MRZ *mrz, const char *s) {
 	// Switzerland has something like an MRZ on its driver licenses.
 	// See "doc/swiss_fak.pdf".
-	int *e = mrz->errors;
 	int success = 1;
 
 	// First line, which is much shorter and contains just meta data.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->blank_number), mrz->blank_number,
-			6, MRZ_ALL,
-			MRZ_ERROR_SWISS_BLANK_NUMBER, e);
+			6, MRZ_CLASS_ALL,
+			MRZ_ERROR_SWISS_BLANK_NUMBER, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->language), mrz->language,
-			3, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_SWISS_LANGUAGE, e);
+			3, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_SWISS_LANGUAGE, mrz);
 	if (!strchr("DFIR", *mrz->language)) {
-		mrz_add_error(e, MRZ_ERROR_SWISS_LANGUAGE);
+		mrz_add_error(mrz, MRZ_ERROR_SWISS_LANGUAGE);
 		success = 0;
 	}
 
 	// Second line.
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_code), mrz->document_code,
-			2, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_CODE, e);
+			2, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_CODE, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->issuing_state), mrz->issuing_state,
-			3, "CHE",
-			MRZ_ERROR_ISSUING_STATE, e);
+			3, MRZ_CLASS_CHARACTER,
+			MRZ_ERROR_ISSUING_STATE, mrz);
 	if (strncmp("CHE", mrz->issuing_state, 3)) {
-		mrz_add_error(e, MRZ_ERROR_ISSUING_STATE);
+		mrz_add_error(mrz, MRZ_ERROR_ISSUING_STATE);
 		success = 0;
 	}
 
@@ -895,7 +1336,7 @@ static int mrz_parse_dl_swiss(MRZ *mrz, const char *s) {
 	// (at least) two versions with a different length.
 	const char *p = strstr(s, MRZ_FILLER_SEPARATOR);
 	if (!p) {
-		mrz_add_error(e, MRZ_ERROR_DOCUMENT_NUMBER);
+		mrz_add_error(mrz, MRZ_ERROR_DOCUMENT_NUMBER);
 		return 0;
 	}
 	int dnlen = p - s;
@@ -905,68 +1346,214 @@ static int mrz_parse_dl_swiss(MRZ *mrz, const char *s) {
 	} else if (dnlen == 15 || dnlen == 16) {
 		remaining = 2;
 	} else {
-		mrz_add_error(e, MRZ_ERROR_DOCUMENT_NUMBER);
+		mrz_add_error(mrz, MRZ_ERROR_DOCUMENT_NUMBER);
 		return 0;
 	}
 
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->document_number), mrz->document_number,
-			dnlen, MRZ_ALL,
-			MRZ_ERROR_DOCUMENT_NUMBER, e);
+			dnlen, MRZ_CLASS_ALL,
+			MRZ_ERROR_DOCUMENT_NUMBER, mrz);
 	char fillers[7];
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(fillers), fillers,
-			2, MRZ_FILLER,
-			MRZ_ERROR_SWISS_FILLER, e);
+			2, MRZ_CLASS_FILLER,
+			MRZ_ERROR_SWISS_FILLER, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(mrz->date_of_birth), mrz->date_of_birth,
-			6, MRZ_NUMBERS_AND_FILLER,
-			MRZ_ERROR_DATE_OF_BIRTH, e);
+			6, MRZ_CLASS_NUMBER_OR_FILLER,
+			MRZ_ERROR_DATE_OF_BIRTH, mrz);
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(fillers), fillers,
-			remaining, MRZ_FILLER,
-			MRZ_ERROR_SWISS_FILLER, e);
+			remaining, MRZ_CLASS_FILLER,
+			MRZ_ERROR_SWISS_FILLER, mrz);
 
 	// Third line.
 	int len = dnlen + 2 + 6 + remaining;
 	char identifiers[32] = {0};
 	success &= mrz_parse_component(&s,
 			MRZ_CAPACITY(identifiers), identifiers,
-			len, MRZ_CHARACTERS_AND_FILLER,
-			MRZ_ERROR_IDENTIFIERS, e);
+			len, MRZ_CLASS_CHARACTER_OR_FILLER,
+			MRZ_ERROR_IDENTIFIERS, mrz);
 	mrz_parse_identifiers(mrz, identifiers);
 
 	return success;
 }
 
-static char *mrz_purify(char *dst, const char *src, size_t len) {
+// Copy all characters of the MRZ alphabet from the first src_len
+// bytes of src into dst. Fails as soon as there are more than len
+// characters or the input is longer than MRZ_MAX_INPUT, so the work
+// per call is bounded no matter how long the input is.
+static char *mrz_purify(char *dst, const char *src, size_t src_len,
+		size_t len) {
 	const char *end = dst + len;
-	while (dst <= end) {
-		src += strcspn(src, MRZ_ALL);
-		size_t sl = strspn(src, MRZ_ALL);
-		if (sl < 1) {
-			break;
+	size_t i = 0;
+	for (; i < MRZ_MAX_INPUT && i < src_len && src[i]; ++i) {
+		if (!(mrz_classes[(unsigned char) src[i]] & MRZ_CLASS_ALL)) {
+			continue;
 		}
-		if (dst + sl > end) {
+		if (dst >= end) {
 			return NULL;
 		}
-		strncpy(dst, src, sl);
-		dst += sl;
-		src += sl;
+		*dst++ = src[i];
+	}
+	if (i < src_len && src[i]) {
+		return NULL;
 	}
 	*dst = 0;
 	return dst;
 }
 
-int parse_mrz(MRZ *mrz, const char *s) {
-	if (!mrz || !s) {
-		return 0;
+// Characters that OCR engines commonly confuse with characters from
+// the MRZ alphabet. Must be sorted by code point.
+static const struct {
+	uint32_t code_point;
+	char c;
+} mrz_lookalikes[] = {
+	{0x00ab, '<'}, // LEFT-POINTING DOUBLE ANGLE QUOTATION MARK
+	{0x02c2, '<'}, // MODIFIER LETTER LEFT ARROWHEAD
+	{0x0391, 'A'}, {0x0392, 'B'}, {0x0395, 'E'}, {0x0396, 'Z'},
+	{0x0397, 'H'}, {0x0399, 'I'}, {0x039a, 'K'}, {0x039c, 'M'},
+	{0x039d, 'N'}, {0x039f, 'O'}, {0x03a1, 'P'}, {0x03a4, 'T'},
+	{0x03a5, 'Y'}, {0x03a7, 'X'}, {0x03bf, 'O'}, // Greek
+	{0x0405, 'S'}, {0x0406, 'I'}, {0x0408, 'J'}, {0x0410, 'A'},
+	{0x0412, 'B'}, {0x0415, 'E'}, {0x041a, 'K'}, {0x041c, 'M'},
+	{0x041d, 'H'}, {0x041e, 'O'}, {0x0420, 'P'}, {0x0421, 'C'},
+	{0x0422, 'T'}, {0x0423, 'Y'}, {0x0425, 'X'}, {0x0430, 'A'},
+	{0x0435, 'E'}, {0x043e, 'O'}, {0x0440, 'P'}, {0x0441, 'C'},
+	{0x0443, 'Y'}, {0x0445, 'X'}, {0x0455, 'S'}, {0x0456, 'I'},
+	{0x0458, 'J'}, // Cyrillic
+	{0x2039, '<'}, // SINGLE LEFT-POINTING ANGLE QUOTATION MARK
+	{0x2329, '<'}, // LEFT-POINTING ANGLE BRACKET
+	{0x276e, '<'}, // HEAVY LEFT-POINTING ANGLE QUOTATION MARK ORNAMENT
+	{0x27e8, '<'}, // MATHEMATICAL LEFT ANGLE BRACKET
+	{0x3008, '<'}, // LEFT ANGLE BRACKET
+};
+
+static char mrz_ascii_to_mrz(uint32_t c) {
+	if ((c > 64 && c < 91) || (c > 47 && c < 58) || c == 60) {
+		return (char) c;
+	} else if (c > 96 && c < 123) {
+		return (char) (c - 32);
 	}
-	memset(mrz, 0, sizeof(MRZ));
-	char pure[91];
-	if (!mrz_purify(pure, s, MRZ_CAPACITY(pure))) {
-		return 0;
+	return 0;
+}
+
+static char mrz_lookalike(uint32_t cp) {
+	if (cp > 0xff00 && cp < 0xff5f) {
+		// Fullwidth forms of ASCII characters.
+		return mrz_ascii_to_mrz(cp - 0xfee0);
+	}
+	size_t l = 0;
+	size_t r = MRZ_ARRAY_SIZE(mrz_lookalikes);
+	while (l < r) {
+		size_t m = (l + r) / 2;
+		if (mrz_lookalikes[m].code_point < cp) {
+			l = m + 1;
+		} else {
+			r = m;
+		}
+	}
+	return l < MRZ_ARRAY_SIZE(mrz_lookalikes) &&
+			mrz_lookalikes[l].code_point == cp
+		? mrz_lookalikes[l].c
+		: 0;
+}
+
+// Like mrz_purify() but decodes UTF-8 and maps lowercase letters and
+// lookalikes to the MRZ alphabet. Counts every mapped character.
+// A multi-byte sequence may end just beyond MRZ_MAX_INPUT.
+static char *mrz_purify_utf8(char *dst, const char *src, size_t src_len,
+		size_t len, int *substitutions) {
+	const char *end = dst + len;
+	const unsigned char *p = (const unsigned char *) src;
+	for (size_t i = 0; i < src_len && p[i]; ) {
+		if (i >= MRZ_MAX_INPUT) {
+			return NULL;
+		}
+		uint32_t cp = p[i++];
+		if (cp > 0x7f) {
+			int n = cp > 0xef ? 3 : cp > 0xdf ? 2 : cp > 0xbf ? 1 : 0;
+			if (n < 1 || cp > 0xf4) {
+				continue; // Invalid or continuation byte.
+			}
+			// Smallest code point that needs n continuation bytes.
+			static const uint32_t min[] = {0, 0x80, 0x800, 0x10000};
+			uint32_t least = min[n];
+			cp &= 0x3f >> n;
+			for (; n > 0 && i < src_len && (p[i] & 0xc0) == 0x80; --n) {
+				cp = cp << 6 | (p[i++] & 0x3f);
+			}
+			if (n > 0) {
+				continue; // Truncated sequence.
+			}
+			// Overlong encodings, surrogates and code points beyond
+			// U+10FFFF are invalid, see RFC 3629.
+			if (cp < least || (cp >= 0xd800 && cp <= 0xdfff) ||
+					cp > 0x10ffff) {
+				continue;
+			}
+		}
+		char c = cp < 0x80 ? mrz_ascii_to_mrz(cp) : mrz_lookalike(cp);
+		if (!c) {
+			continue;
+		}
+		if (dst >= end) {
+			return NULL;
+		}
+		*substitutions += (uint32_t) c != cp;
+		*dst++ = c;
+	}
+	*dst = 0;
+	return dst;
+}
+
+// Errors that make a field malformed or fail its check sum, indexed by
+// MRZ_FIELD_*.
+#define MRZ_B(code) MRZ_ERROR_BIT(MRZ_ERROR_##code)
+static const struct {
+	size_t offset;
+	uint64_t malformed;
+	uint64_t checksum;
+} mrz_field_errors[MRZ_FIELDS] = {
+	{offsetof(MRZ, document_code),
+		MRZ_B(DOCUMENT_CODE) | MRZ_B(VISA) | MRZ_B(NO_VISA), 0},
+	{offsetof(MRZ, issuing_state), MRZ_B(ISSUING_STATE), 0},
+	{offsetof(MRZ, primary_identifier), MRZ_B(IDENTIFIERS), 0},
+	{offsetof(MRZ, secondary_identifier), MRZ_B(IDENTIFIERS), 0},
+	{offsetof(MRZ, nationality), MRZ_B(NATIONALITY), 0},
+	{offsetof(MRZ, document_number), MRZ_B(DOCUMENT_NUMBER),
+		MRZ_B(DOCUMENT_NUMBER_CHECK_DIGIT) |
+		MRZ_B(CSUM_DOCUMENT_NUMBER)},
+	{offsetof(MRZ, date_of_birth), MRZ_B(DATE_OF_BIRTH),
+		MRZ_B(DATE_OF_BIRTH_CHECK_DIGIT) | MRZ_B(CSUM_DOB)},
+	{offsetof(MRZ, sex), MRZ_B(SEX), 0},
+	// France derives the date of expiry from the date of issuance.
+	{offsetof(MRZ, date_of_expiry), MRZ_B(DATE_OF_EXPIRY) |
+		MRZ_B(YEAR_OF_ISSUANCE) | MRZ_B(MONTH_OF_ISSUANCE),
+		MRZ_B(DATE_OF_EXPIRY_CHECK_DIGIT) | MRZ_B(CSUM_DOE)},
+	{offsetof(MRZ, optional_data1), MRZ_B(OPTIONAL_DATA1), 0},
+	{offsetof(MRZ, optional_data2), MRZ_B(OPTIONAL_DATA2), 0},
+	{offsetof(MRZ, blank_number), MRZ_B(SWISS_BLANK_NUMBER), 0},
+	{offsetof(MRZ, language), MRZ_B(SWISS_LANGUAGE), 0},
+};
+#undef MRZ_B
+
+static void mrz_set_status(MRZ *mrz) {
+	uint64_t mask = mrz->error_mask;
+	for (int f = 0; f < MRZ_FIELDS; ++f) {
+		const char *value = (const char *) mrz + mrz_field_errors[f].offset;
+		mrz->status[f] = mask & mrz_field_errors[f].malformed
+			? MRZ_STATUS_MALFORMED
+			: !*value
+			? MRZ_STATUS_ABSENT
+			: mask & mrz_field_errors[f].checksum
+			? MRZ_STATUS_CHECKSUM_FAILED
+			: MRZ_STATUS_VALID;
 	}
+}
+
+static int mrz_parse_pure(MRZ *mrz, const char *pure) {
 	int is_visa = *pure == 'V';
 	int result = -1;
 	switch (strlen(pure)) {
@@ -992,6 +1579,10 @@ int parse_mrz(MRZ *mrz, const char *s) {
 		default:
 			return 0;
 	}
+	memcpy(mrz->printed_date_of_birth, mrz->date_of_birth,
+			sizeof(mrz->printed_date_of_birth));
+	memcpy(mrz->printed_date_of_expiry, mrz->date_of_expiry,
+			sizeof(mrz->printed_date_of_expiry));
 	// Trim fillers.
 	mrz_trim_fillers(mrz->document_code);
 	mrz_trim_fillers(mrz->issuing_state);
@@ -1011,8 +1602,1873 @@ int parse_mrz(MRZ *mrz, const char *s) {
 	mrz_replace_fillers(mrz->date_of_birth);
 	mrz_replace_fillers(mrz->sex);
 	mrz_replace_fillers(mrz->date_of_expiry);
+	mrz_set_status(mrz);
+	return result;
+}
+
+#define MRZ_FILTER_FIELD(field) {#field, offsetof(MRZ, field)}
+static const struct {
+	const char *name;
+	size_t field;
+} mrz_filter_fields[] = {
+	MRZ_FILTER_FIELD(document_code),
+	MRZ_FILTER_FIELD(issuing_state),
+	MRZ_FILTER_FIELD(document_number),
+	MRZ_FILTER_FIELD(primary_identifier),
+	MRZ_FILTER_FIELD(secondary_identifier),
+	MRZ_FILTER_FIELD(nationality),
+	MRZ_FILTER_FIELD(date_of_birth),
+	MRZ_FILTER_FIELD(sex),
+	MRZ_FILTER_FIELD(date_of_expiry),
+	MRZ_FILTER_FIELD(optional_data1),
+	MRZ_FILTER_FIELD(optional_data2),
+	MRZ_FILTER_FIELD(blank_number),
+	MRZ_FILTER_FIELD(language),
+};
+#undef MRZ_FILTER_FIELD
+
+// Fields that are at the same position in every MRZ of the same
+// length, so they can be tested before the MRZ is parsed. Positions
+// are given for TD1 (90 characters), TD2 and MRV-B (72) and TD3 and
+// MRV-A (88).
+#define MRZ_FILTER_FIXED(field, td1, td2, td3, len, trim) \
+	{offsetof(MRZ, field), {td1, td2, td3}, len, trim}
+static const struct {
+	size_t field;
+	unsigned char position[3];
+	unsigned char length;
+	int trim;
+} mrz_filter_fixed[] = {
+	MRZ_FILTER_FIXED(document_code, 0, 0, 0, 2, 1),
+	MRZ_FILTER_FIXED(issuing_state, 2, 2, 2, 3, 1),
+	MRZ_FILTER_FIXED(document_number, 5, 36, 44, 9, 1),
+	MRZ_FILTER_FIXED(nationality, 45, 46, 54, 3, 1),
+	MRZ_FILTER_FIXED(date_of_birth, 30, 49, 57, 6, 1),
+	MRZ_FILTER_FIXED(sex, 37, 56, 64, 1, 0),
+	MRZ_FILTER_FIXED(date_of_expiry, 38, 57, 65, 6, 1),
+};
+#undef MRZ_FILTER_FIXED
+
+// Turn a date of the form YYMMDD into YYYYMMDD. Returns -1 unless
+// all six characters are digits.
+static long mrz_filter_date(const char *s, int pivot) {
+	long date = 0;
+	int i = 0;
+	for (; i < 6 && s[i] >= '0' && s[i] <= '9'; ++i) {
+		date = date * 10 + s[i] - '0';
+	}
+	if (i < 6 || s[i]) {
+		return -1;
+	}
+	return date + (date / 10000 > pivot ? 19000000 : 20000000);
+}
+
+static int mrz_filter_pivot(size_t field) {
+	// Divide by the average length of a Gregorian year instead of
+	// calling gmtime(), which isn't thread-safe. Being off by a day
+	// around new year doesn't matter here.
+	int year = (int) ((1970 + (long) (time(NULL) / 31556952)) % 100);
+	if (field == offsetof(MRZ, date_of_expiry)) {
+		year += 50;
+	}
+	return year < 99 ? year : 99;
+}
+
+// Compile an expression like "nationality=D|FRA,date_of_expiry<300101"
+// into a filter. All predicates must hold. Returns 0 if the expression
+// is invalid.
+int mrz_filter_compile(MRZ_FILTER *filter, const char *expr) {
+	static const struct {
+		const char *token;
+		int op;
+	} ops[] = {
+		// Longer operators first.
+		{"!=", MRZ_FILTER_NE},
+		{"<=", MRZ_FILTER_LE},
+		{">=", MRZ_FILTER_GE},
+		{"=", MRZ_FILTER_EQ},
+		{"<", MRZ_FILTER_LT},
+		{">", MRZ_FILTER_GT},
+	};
+	if (!filter || !expr) {
+		return 0;
+	}
+	filter->count = 0;
+	for (;;) {
+		if (filter->count >= MRZ_FILTER_MAX) {
+			return 0;
+		}
+		MRZ_PREDICATE *p = filter->predicates + filter->count;
+		size_t len = strcspn(expr, "!=<>,");
+		size_t f = 0;
+		for (; f < MRZ_ARRAY_SIZE(mrz_filter_fields); ++f) {
+			const char *name = mrz_filter_fields[f].name;
+			if (strlen(name) == len && !strncmp(name, expr, len)) {
+				break;
+			}
+		}
+		if (f >= MRZ_ARRAY_SIZE(mrz_filter_fields)) {
+			return 0;
+		}
+		p->field = mrz_filter_fields[f].field;
+		expr += len;
+		size_t o = 0;
+		for (; o < MRZ_ARRAY_SIZE(ops); ++o) {
+			size_t n = strlen(ops[o].token);
+			if (!strncmp(expr, ops[o].token, n)) {
+				p->op = ops[o].op;
+				expr += n;
+				break;
+			}
+		}
+		if (o >= MRZ_ARRAY_SIZE(ops)) {
+			return 0;
+		}
+		len = strcspn(expr, ",");
+		if (len >= MRZ_FILTER_VALUE_MAX ||
+				(p->op != MRZ_FILTER_EQ && p->op != MRZ_FILTER_NE &&
+					memchr(expr, '|', len))) {
+			return 0;
+		}
+		memcpy(p->value, expr, len);
+		p->value[len] = 0;
+		expr += len;
+		p->pivot = -1;
+		if (p->op != MRZ_FILTER_EQ && p->op != MRZ_FILTER_NE &&
+				(p->field == offsetof(MRZ, date_of_birth) ||
+				p->field == offsetof(MRZ, date_of_expiry))) {
+			if (mrz_filter_date(p->value, 0) < 0) {
+				return 0;
+			}
+			p->pivot = mrz_filter_pivot(p->field);
+		}
+		p->fixed = -1;
+		for (size_t i = 0; i < MRZ_ARRAY_SIZE(mrz_filter_fixed); ++i) {
+			if (mrz_filter_fixed[i].field == p->field) {
+				p->fixed = i;
+				break;
+			}
+		}
+		++filter->count;
+		if (!*expr) {
+			return 1;
+		}
+		++expr;
+	}
+}
+
+static int mrz_predicate_match(const MRZ_PREDICATE *p, const char *s) {
+	if (p->op == MRZ_FILTER_EQ || p->op == MRZ_FILTER_NE) {
+		size_t len = strlen(s);
+		int found = 0;
+		for (const char *v = p->value; !found; ++v) {
+			size_t n = strcspn(v, "|");
+			found = n == len && !strncmp(v, s, n);
+			v += n;
+			if (!*v) {
+				break;
+			}
+		}
+		return found ^ (p->op == MRZ_FILTER_NE);
+	}
+	int cmp;
+	if (p->pivot > -1) {
+		// Dates that aren't complete don't compare.
+		long a = mrz_filter_date(s, p->pivot);
+		long b = mrz_filter_date(p->value, p->pivot);
+		if (a < 0) {
+			return 0;
+		}
+		cmp = (a > b) - (a < b);
+	} else {
+		cmp = strcmp(s, p->value);
+	}
+	switch (p->op) {
+	case MRZ_FILTER_LT:
+		return cmp < 0;
+	case MRZ_FILTER_LE:
+		return cmp <= 0;
+	case MRZ_FILTER_GT:
+		return cmp > 0;
+	default:
+		return cmp >= 0;
+	}
+}
+
+int mrz_filter_match(const MRZ_FILTER *filter, const MRZ *mrz) {
+	for (int i = 0; i < filter->count; ++i) {
+		const MRZ_PREDICATE *p = filter->predicates + i;
+		if (!mrz_predicate_match(p, (const char *) mrz + p->field)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Test the fields at fixed positions right in the characters of the
+// MRZ. Returns 0 only if the parsed MRZ can't match either.
+static int mrz_filter_pure(const MRZ_FILTER *filter, const char *pure) {
+	int layout;
+	switch (strlen(pure)) {
+	case 90:
+		layout = 0;
+		break;
+	case 72:
+		if (!strncmp(pure, "IDFRA", 5)) {
+			return 1;
+		}
+		layout = 1;
+		break;
+	case 88:
+		layout = 2;
+		break;
+	default:
+		return 1;
+	}
+	for (int i = 0; i < filter->count; ++i) {
+		const MRZ_PREDICATE *p = filter->predicates + i;
+		if (p->fixed < 0) {
+			continue;
+		}
+		const char *s = pure + mrz_filter_fixed[p->fixed].position[layout];
+		size_t len = mrz_filter_fixed[p->fixed].length;
+		// An extended document number continues in the optional data.
+		if (p->field == offsetof(MRZ, document_number) &&
+				s[len] == *MRZ_FILLER) {
+			continue;
+		}
+		char value[10];
+		memcpy(value, s, len);
+		value[len] = 0;
+		if (mrz_filter_fixed[p->fixed].trim) {
+			mrz_trim_fillers(value);
+		}
+		mrz_replace_fillers(value);
+		if (!mrz_predicate_match(p, value)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Parse only if the fields at fixed positions match the filter, so
+// most of the work is skipped for MRZs that are filtered out.
+static int mrz_parse_pure_where(MRZ *mrz, const char *pure,
+		const MRZ_FILTER *filter) {
+	if (!filter) {
+		return mrz_parse_pure(mrz, pure);
+	}
+	if (!mrz_filter_pure(filter, pure)) {
+		mrz->rejected = 1;
+		return 0;
+	}
+	int result = mrz_parse_pure(mrz, pure);
+	if (!mrz_filter_match(filter, mrz)) {
+		mrz->rejected = 1;
+		return 0;
+	}
+	return result;
+}
+
+int parse_mrz(MRZ *mrz, const char *s) {
+	return parse_mrz_n(mrz, s, SIZE_MAX);
+}
+
+int parse_mrz_where(MRZ *mrz, const char *s, const MRZ_FILTER *filter) {
+	if (!mrz || !s) {
+		return 0;
+	}
+	memset(mrz, 0, sizeof(MRZ));
+	char pure[91];
+	if (!mrz_purify(pure, s, SIZE_MAX, MRZ_CAPACITY(pure))) {
+		return 0;
+	}
+	return mrz_parse_pure_where(mrz, pure, filter);
+}
+
+int parse_mrz_n(MRZ *mrz, const char *s, size_t len) {
+	if (!mrz || !s) {
+		return 0;
+	}
+	memset(mrz, 0, sizeof(MRZ));
+	char pure[91];
+	if (!mrz_purify(pure, s, len, MRZ_CAPACITY(pure))) {
+		return 0;
+	}
+	return mrz_parse_pure(mrz, pure);
+}
+
+void mrz_context_init(MRZ_CONTEXT *ctx) {
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+void mrz_context_filter(MRZ_CONTEXT *ctx, const MRZ_FILTER *filter) {
+	ctx->filter = filter;
+}
+
+void mrz_context_utf8(MRZ_CONTEXT *ctx, int utf8) {
+	ctx->utf8 = utf8;
+}
+
+void mrz_context_pseudonymize(MRZ_CONTEXT *ctx, const unsigned char *key) {
+	ctx->pseudonymize = key != NULL;
+	if (key) {
+		memcpy(ctx->key, key, sizeof(ctx->key));
+	}
+}
+
+// Clear what a previous parse has set. Every field is null-terminated
+// whenever it is written, so it's enough to clear the first byte.
+static void mrz_reset(MRZ *mrz) {
+	*mrz->document_code = 0;
+	*mrz->issuing_state = 0;
+	*mrz->primary_identifier = 0;
+	*mrz->secondary_identifier = 0;
+	*mrz->nationality = 0;
+	*mrz->document_number = 0;
+	*mrz->date_of_birth = 0;
+	*mrz->sex = 0;
+	*mrz->date_of_expiry = 0;
+	*mrz->optional_data1 = 0;
+	*mrz->optional_data2 = 0;
+	*mrz->blank_number = 0;
+	*mrz->language = 0;
+	*mrz->bac_information = 0;
+	*mrz->printed_date_of_birth = 0;
+	*mrz->printed_date_of_expiry = 0;
+	memset(mrz->errors, 0,
+			mrz_popcount(mrz->error_mask) * sizeof(*mrz->errors));
+	mrz->error_mask = 0;
+	memset(mrz->status, 0, sizeof(mrz->status));
+	mrz->substitutions = 0;
+	mrz->primary_names.count = 0;
+	mrz->primary_names.truncated = 0;
+	mrz->secondary_names.count = 0;
+	mrz->secondary_names.truncated = 0;
+	mrz->pseudonymized = 0;
+	mrz->rejected = 0;
+}
+
+int parse_mrz_ctx(MRZ_CONTEXT *ctx, const char *s) {
+	return parse_mrz_ctx_n(ctx, s, SIZE_MAX);
+}
+
+int parse_mrz_ctx_n(MRZ_CONTEXT *ctx, const char *s, size_t len) {
+	if (!ctx || !s) {
+		return 0;
+	}
+	mrz_reset(&ctx->mrz);
+	size_t cap = MRZ_CAPACITY(ctx->pure);
+	int result = (ctx->utf8
+			? mrz_purify_utf8(ctx->pure, s, len, cap,
+					&ctx->mrz.substitutions)
+			: mrz_purify(ctx->pure, s, len, cap))
+		? mrz_parse_pure_where(&ctx->mrz, ctx->pure, ctx->filter)
+		: 0;
+	if (ctx->pseudonymize) {
+		// Don't leave the raw values in the scratch buffer either.
+		mrz_pseudonymize(&ctx->mrz, ctx->key);
+		memset(ctx->pure, 0, sizeof(ctx->pure));
+	}
 	return result;
 }
+
+struct MRZ_LINE {
+	const char *start;
+	const char *end;
+	int length;
+};
+
+struct MRZ_LOCATOR {
+	struct MRZ_LINE lines[3];
+	int n;
+	MRZ_LOCATION *locations;
+	size_t found;
+	size_t max;
+};
+
+static void mrz_locator_pop(struct MRZ_LOCATOR *l, int n) {
+	l->n -= n;
+	memmove(l->lines, l->lines + n, l->n * sizeof(*l->lines));
+}
+
+static void mrz_locator_emit(struct MRZ_LOCATOR *l, int n) {
+	if (l->found < l->max) {
+		MRZ_LOCATION *loc = l->locations + l->found++;
+		loc->start = l->lines[0].start;
+		loc->length = l->lines[n - 1].end - loc->start;
+		loc->lines = n;
+	}
+	mrz_locator_pop(l, n);
+}
+
+// Match the pending lines against the known layouts: two lines of 44
+// (TD3, MRV-A) or 36 (TD2, MRV-B, France), three lines of 30 (TD1) and
+// one line of 9 followed by two lines of 30 or 31 (Swiss driver
+// license). Lines that cannot start a layout are dropped. If final is
+// set, no more lines will follow.
+static void mrz_locator_reduce(struct MRZ_LOCATOR *l, int final) {
+	while (l->n > 0) {
+		int first = l->lines[0].length;
+		int need = first == 44 || first == 36 ? 2
+			: first == 30 || first == 9 ? 3
+			: 0;
+		int second = first == 9 ? 30 : first;
+		int i = 1;
+		for (; i < need && i < l->n; ++i) {
+			int len = l->lines[i].length;
+			if (len != (i > 1 ? l->lines[1].length : second) &&
+					!(first == 9 && i == 1 && len == 31)) {
+				break;
+			}
+		}
+		if (need > 0 && i == need) {
+			mrz_locator_emit(l, need);
+		} else if (need > 0 && i == l->n && !final) {
+			break; // Wait for more lines.
+		} else {
+			mrz_locator_pop(l, 1);
+		}
+	}
+}
+
+size_t mrz_locate(const char *text, size_t len, MRZ_LOCATION *locations,
+		size_t max) {
+	if (!text || !locations) {
+		return 0;
+	}
+	struct MRZ_LOCATOR l;
+	l.n = 0;
+	l.locations = locations;
+	l.found = 0;
+	l.max = max;
+	// Scan every line once and keep those that consist of MRZ
+	// characters, white space and at least one filler only.
+	for (const char *p = text, *end = text + len; p < end; ) {
+		const char *start = NULL;
+		const char *last = NULL;
+		int count = 0;
+		int fillers = 0;
+		int valid = 1;
+		for (; p < end && *p != '\n'; ++p) {
+			unsigned char c = *p;
+			if (mrz_classes[c] & MRZ_CLASS_ALL) {
+				if (!start) {
+					start = p;
+				}
+				last = p;
+				++count;
+				fillers += c == *MRZ_FILLER;
+			} else if (c != ' ' && c != '\t' && c != '\r') {
+				valid = 0;
+			}
+		}
+		++p;
+		if (valid && fillers > 0 && count < 45) {
+			struct MRZ_LINE *line = l.lines + l.n++;
+			line->start = start;
+			line->end = last + 1;
+			line->length = count;
+			mrz_locator_reduce(&l, 0);
+		} else if (l.n > 0) {
+			mrz_locator_reduce(&l, 1);
+		}
+		if (l.found >= l.max) {
+			break;
+		}
+	}
+	mrz_locator_reduce(&l, 1);
+	return l.found;
+}
+
+int parse_mrz_utf8(MRZ *mrz, const char *s) {
+	return parse_mrz_utf8_n(mrz, s, SIZE_MAX);
+}
+
+int parse_mrz_utf8_n(MRZ *mrz, const char *s, size_t len) {
+	if (!mrz || !s) {
+		return 0;
+	}
+	memset(mrz, 0, sizeof(MRZ));
+	char pure[91];
+	if (!mrz_purify_utf8(pure, s, len, MRZ_CAPACITY(pure),
+			&mrz->substitutions)) {
+		return 0;
+	}
+	return mrz_parse_pure(mrz, pure);
+}
+
+int parse_mrz_utf8_where(MRZ *mrz, const char *s,
+		const MRZ_FILTER *filter) {
+	if (!mrz || !s) {
+		return 0;
+	}
+	memset(mrz, 0, sizeof(MRZ));
+	char pure[91];
+	if (!mrz_purify_utf8(pure, s, SIZE_MAX, MRZ_CAPACITY(pure),
+			&mrz->substitutions)) {
+		return 0;
+	}
+	return mrz_parse_pure_where(mrz, pure, filter);
+}
+
+int mrz_bac_information(const MRZ *mrz, char *dst, size_t cap) {
+	// Only ICAO documents have a chip that can be accessed with
+	// BAC/PACE, so France and Swiss driver licenses have none.
+	if (!mrz || !dst || cap < 1) {
+		return 0;
+	}
+	size_t len = strlen(mrz->bac_information);
+	if (len < 1 || len >= cap) {
+		*dst = 0;
+		return 0;
+	}
+	memcpy(dst, mrz->bac_information, len + 1);
+	return len;
+}
+
+static uint32_t mrz_rol(uint32_t x, int n) {
+	return (x << n) | (x >> (32 - n));
+}
+
+static const uint32_t mrz_sha1_init[] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+static const uint32_t mrz_sha1_k[] = {
+	0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6
+};
+
+static void mrz_sha1_block(uint32_t *h, const unsigned char *block) {
+	uint32_t w[80];
+	for (int t = 0; t < 16; ++t, block += 4) {
+		w[t] = (uint32_t) block[0] << 24 | (uint32_t) block[1] << 16 |
+				(uint32_t) block[2] << 8 | block[3];
+	}
+	for (int t = 16; t < 80; ++t) {
+		w[t] = mrz_rol(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+	}
+	uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+	for (int t = 0; t < 80; ++t) {
+		uint32_t f;
+		switch (t / 20) {
+		case 0: f = (b & c) | (~b & d); break;
+		case 2: f = (b & c) | (b & d) | (c & d); break;
+		default: f = b ^ c ^ d; break;
+		}
+		uint32_t tmp = mrz_rol(a, 5) + f + e + mrz_sha1_k[t / 20] + w[t];
+		e = d;
+		d = c;
+		c = mrz_rol(b, 30);
+		b = a;
+		a = tmp;
+	}
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+}
+
+// Pad a message of up to 55 bytes into a single SHA-1 block.
+static void mrz_sha1_pad(unsigned char *block, const char *msg,
+		size_t len) {
+	memset(block, 0, 64);
+	memcpy(block, msg, len);
+	block[len] = 0x80;
+	block[62] = (unsigned char) (len >> 5);
+	block[63] = (unsigned char) (len << 3);
+}
+
+static void mrz_sha1(unsigned char *digest, const char *msg, size_t len) {
+	uint32_t h[5];
+	memcpy(h, mrz_sha1_init, sizeof(h));
+	size_t i = 0;
+	for (; len - i >= 64; i += 64) {
+		mrz_sha1_block(h, (const unsigned char *) msg + i);
+	}
+	unsigned char block[64] = {0};
+	size_t rest = len - i;
+	memcpy(block, msg + i, rest);
+	block[rest] = 0x80;
+	if (rest > 55) {
+		mrz_sha1_block(h, block);
+		memset(block, 0, sizeof(block));
+	}
+	uint64_t bits = (uint64_t) len << 3;
+	for (int b = 0; b < 8; ++b) {
+		block[63 - b] = (unsigned char) (bits >> (b * 8));
+	}
+	mrz_sha1_block(h, block);
+	for (int b = 0; b < 20; ++b) {
+		digest[b] = (unsigned char) (h[b / 4] >> (24 - (b % 4) * 8));
+	}
+}
+
+// Hash MRZ_SHA1_LANES single block messages at once. Every step is
+// done for all lanes in a row so the compiler can map the lanes onto
+// SIMD registers.
+#define MRZ_SHA1_LANES 8
+static void mrz_sha1_lanes(unsigned char (*digests)[20],
+		const unsigned char (*blocks)[64]) {
+	uint32_t w[16][MRZ_SHA1_LANES];
+	for (int t = 0; t < 16; ++t) {
+		for (int l = 0; l < MRZ_SHA1_LANES; ++l) {
+			const unsigned char *p = blocks[l] + t * 4;
+			w[t][l] = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+					(uint32_t) p[2] << 8 | p[3];
+		}
+	}
+	uint32_t a[MRZ_SHA1_LANES], b[MRZ_SHA1_LANES], c[MRZ_SHA1_LANES],
+			d[MRZ_SHA1_LANES], e[MRZ_SHA1_LANES], f[MRZ_SHA1_LANES];
+	for (int l = 0; l < MRZ_SHA1_LANES; ++l) {
+		a[l] = mrz_sha1_init[0];
+		b[l] = mrz_sha1_init[1];
+		c[l] = mrz_sha1_init[2];
+		d[l] = mrz_sha1_init[3];
+		e[l] = mrz_sha1_init[4];
+	}
+	for (int t = 0; t < 80; ++t) {
+		uint32_t *wt = w[t & 15];
+		if (t > 15) {
+			uint32_t *w3 = w[(t - 3) & 15];
+			uint32_t *w8 = w[(t - 8) & 15];
+			uint32_t *w14 = w[(t - 14) & 15];
+			for (int l = 0; l < MRZ_SHA1_LANES; ++l) {
+				wt[l] = mrz_rol(w3[l] ^ w8[l] ^ w14[l] ^ wt[l], 1);
+			}
+		}
+		int round = t / 20;
+		if (round == 0) {
+			for (int l = 0; l < MRZ_SHA1_LANES; ++l) {
+				f[l] = (b[l] & c[l]) | (~b[l] & d[l]);
+			}
+		} else if (round == 2) {
+			for (int l = 0; l < MRZ_SHA1_LANES; ++l) {
+				f[l] = (b[l] & c[l]) | (b[l] & d[l]) | (c[l] & d[l]);
+			}
+		} else {
+			for (int l = 0; l < MRZ_SHA1_LANES; ++l) {
+				f[l] = b[l] ^ c[l] ^ d[l];
+			}
+		}
+		uint32_t k = mrz_sha1_k[round];
+		for (int l = 0; l < MRZ_SHA1_LANES; ++l) {
+			uint32_t tmp = mrz_rol(a[l], 5) + f[l] + e[l] + k + wt[l];
+			e[l] = d[l];
+			d[l] = c[l];
+			c[l] = mrz_rol(b[l], 30);
+			b[l] = a[l];
+			a[l] = tmp;
+		}
+	}
+	for (int l = 0; l < MRZ_SHA1_LANES; ++l) {
+		uint32_t h[5] = {
+			mrz_sha1_init[0] + a[l],
+			mrz_sha1_init[1] + b[l],
+			mrz_sha1_init[2] + c[l],
+			mrz_sha1_init[3] + d[l],
+			mrz_sha1_init[4] + e[l]
+		};
+		for (int i = 0; i < 20; ++i) {
+			digests[l][i] = (unsigned char) (h[i / 4] >> (24 - (i % 4) * 8));
+		}
+	}
+}
+
+int mrz_bac_kseed(const MRZ *mrz, unsigned char *kseed) {
+	char info[91];
+	int len = mrz_bac_information(mrz, info, sizeof(info));
+	if (len < 1 || !kseed) {
+		return 0;
+	}
+	unsigned char digest[20];
+	mrz_sha1(digest, info, len);
+	memcpy(kseed, digest, MRZ_BAC_KSEED_LENGTH);
+	return 1;
+}
+
+size_t mrz_bac_kseed_batch(const MRZ *mrzs, size_t n,
+		unsigned char (*kseeds)[MRZ_BAC_KSEED_LENGTH]) {
+	if (!mrzs || !kseeds) {
+		return 0;
+	}
+	unsigned char blocks[MRZ_SHA1_LANES][64] = {{0}};
+	unsigned char digests[MRZ_SHA1_LANES][20];
+	size_t lane_index[MRZ_SHA1_LANES];
+	int lanes = 0;
+	size_t derived = 0;
+	for (size_t i = 0; i < n; ++i) {
+		char info[91];
+		int len = mrz_bac_information(mrzs + i, info, sizeof(info));
+		if (len < 1) {
+			memset(kseeds[i], 0, MRZ_BAC_KSEED_LENGTH);
+			continue;
+		}
+		++derived;
+		if (len > 55) {
+			// Extended document numbers may need a second block.
+			mrz_sha1(digests[0], info, len);
+			memcpy(kseeds[i], digests[0], MRZ_BAC_KSEED_LENGTH);
+			continue;
+		}
+		mrz_sha1_pad(blocks[lanes], info, len);
+		lane_index[lanes] = i;
+		if (++lanes < MRZ_SHA1_LANES && i + 1 < n) {
+			continue;
+		}
+		// Unused lanes just hash whatever is left in there.
+		mrz_sha1_lanes(digests, (const unsigned char (*)[64]) blocks);
+		for (int l = 0; l < lanes; ++l) {
+			memcpy(kseeds[lane_index[l]], digests[l], MRZ_BAC_KSEED_LENGTH);
+		}
+		lanes = 0;
+	}
+	if (lanes > 0) {
+		mrz_sha1_lanes(digests, (const unsigned char (*)[64]) blocks);
+		for (int l = 0; l < lanes; ++l) {
+			memcpy(kseeds[lane_index[l]], digests[l], MRZ_BAC_KSEED_LENGTH);
+		}
+	}
+	return derived;
+}
+
+// Pseudonymization replaces fields with their SipHash-2-4 (128 bit
+// output) under a secret key. Every field is hashed as a message of
+// fixed length: the index of the token, the length of the value and
+// the value padded with zeros. So the same value in different fields
+// gives different tokens and all messages take the same number of
+// rounds, which is what allows hashing many of them in lockstep.
+#define MRZ_SIPHASH_MESSAGE 48
+#define MRZ_SIPHASH_WORDS (MRZ_SIPHASH_MESSAGE / 8)
+#define MRZ_SIPHASH_LANES 8
+
+static uint64_t mrz_rol64(uint64_t x, int n) {
+	return (x << n) | (x >> (64 - n));
+}
+
+static uint64_t mrz_load64(const unsigned char *p) {
+	uint64_t v = 0;
+	for (int i = 8; i-- > 0; ) {
+		v = v << 8 | p[i];
+	}
+	return v;
+}
+
+static void mrz_store64(unsigned char *p, uint64_t v) {
+	for (int i = 0; i < 8; ++i, v >>= 8) {
+		p[i] = (unsigned char) v;
+	}
+}
+
+#define MRZ_SIPROUND(v0, v1, v2, v3) do { \
+	v0 += v1; v1 = mrz_rol64(v1, 13); v1 ^= v0; v0 = mrz_rol64(v0, 32); \
+	v2 += v3; v3 = mrz_rol64(v3, 16); v3 ^= v2; \
+	v0 += v3; v3 = mrz_rol64(v3, 21); v3 ^= v0; \
+	v2 += v1; v1 = mrz_rol64(v1, 17); v1 ^= v2; v2 = mrz_rol64(v2, 32); \
+} while (0)
+
+static void mrz_siphash128(unsigned char *out, const unsigned char *key,
+		const unsigned char *msg, size_t len) {
+	uint64_t k0 = mrz_load64(key);
+	uint64_t k1 = mrz_load64(key + 8);
+	uint64_t v0 = k0 ^ 0x736f6d6570736575;
+	uint64_t v1 = k1 ^ 0x646f72616e646f6d ^ 0xee;
+	uint64_t v2 = k0 ^ 0x6c7967656e657261;
+	uint64_t v3 = k1 ^ 0x7465646279746573;
+	size_t i = 0;
+	for (; len - i >= 8; i += 8) {
+		uint64_t m = mrz_load64(msg + i);
+		v3 ^= m;
+		MRZ_SIPROUND(v0, v1, v2, v3);
+		MRZ_SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+	uint64_t b = (uint64_t) len << 56;
+	for (size_t r = 0; r < len - i; ++r) {
+		b |= (uint64_t) msg[i + r] << (r * 8);
+	}
+	v3 ^= b;
+	MRZ_SIPROUND(v0, v1, v2, v3);
+	MRZ_SIPROUND(v0, v1, v2, v3);
+	v0 ^= b;
+	v2 ^= 0xee;
+	for (int r = 0; r < 4; ++r) {
+		MRZ_SIPROUND(v0, v1, v2, v3);
+	}
+	mrz_store64(out, v0 ^ v1 ^ v2 ^ v3);
+	v1 ^= 0xdd;
+	for (int r = 0; r < 4; ++r) {
+		MRZ_SIPROUND(v0, v1, v2, v3);
+	}
+	mrz_store64(out + 8, v0 ^ v1 ^ v2 ^ v3);
+}
+
+// Return the field of a token and encode it as message. Returns NULL
+// for empty fields, which get an all zero token.
+static char *mrz_pseudonym_message(MRZ *mrz, int token,
+		unsigned char *msg) {
+	char *fields[MRZ_TOKENS] = {
+		mrz->document_number,
+		mrz->date_of_birth,
+		mrz->primary_identifier,
+		mrz->secondary_identifier
+	};
+	char *field = fields[token];
+	size_t len = strlen(field);
+	memset(msg, 0, MRZ_SIPHASH_MESSAGE);
+	if (len < 1) {
+		return NULL;
+	}
+	msg[0] = (unsigned char) token;
+	msg[1] = (unsigned char) len;
+	memcpy(msg + 2, field, len);
+	return field;
+}
+
+// Clear a buffer on the stack in a way the compiler can't drop as a
+// dead store.
+static void mrz_wipe(void *p, size_t n) {
+	volatile unsigned char *v = p;
+	while (n-- > 0) {
+		*v++ = 0;
+	}
+}
+
+// An extended document number continues at the start of the optional
+// data of TD1 (optional_data1) and TD2 (optional_data2), followed by
+// its check digit. Remove that part of opt if it is there.
+static int mrz_pseudonym_wipe_extension(const MRZ *mrz, char *opt,
+		size_t cap) {
+	size_t dn = strlen(mrz->document_number);
+	size_t ext = strcspn(opt, MRZ_FILLER);
+	if (dn <= 9 || ext < 2 || ext - 1 > dn - 9 ||
+			strncmp(mrz->document_number + dn - (ext - 1), opt,
+					ext - 1)) {
+		return 0;
+	}
+	char rest[sizeof(mrz->optional_data2)];
+	strcpy(rest, opt + ext);
+	mrz_trim_fillers(rest);
+	memset(opt, 0, cap);
+	strcpy(opt, rest);
+	mrz_wipe(rest, sizeof(rest));
+	return 1;
+}
+
+// Remove the raw values once all tokens are there.
+static void mrz_pseudonym_wipe(MRZ *mrz) {
+	if (!mrz_pseudonym_wipe_extension(mrz, mrz->optional_data1,
+			sizeof(mrz->optional_data1))) {
+		mrz_pseudonym_wipe_extension(mrz, mrz->optional_data2,
+				sizeof(mrz->optional_data2));
+	}
+	memset(mrz->document_number, 0, sizeof(mrz->document_number));
+	memset(mrz->date_of_birth, 0, sizeof(mrz->date_of_birth));
+	memset(mrz->printed_date_of_birth, 0,
+			sizeof(mrz->printed_date_of_birth));
+	memset(mrz->primary_identifier, 0, sizeof(mrz->primary_identifier));
+	memset(mrz->secondary_identifier, 0,
+			sizeof(mrz->secondary_identifier));
+	memset(mrz->bac_information, 0, sizeof(mrz->bac_information));
+	memset(&mrz->primary_names, 0, sizeof(mrz->primary_names));
+	memset(&mrz->secondary_names, 0, sizeof(mrz->secondary_names));
+	mrz->pseudonymized = 1;
+}
+
+void mrz_pseudonymize(MRZ *mrz, const unsigned char *key) {
+	if (!mrz || !key || mrz->pseudonymized) {
+		return;
+	}
+	unsigned char msg[MRZ_SIPHASH_MESSAGE];
+	for (int t = 0; t < MRZ_TOKENS; ++t) {
+		if (mrz_pseudonym_message(mrz, t, msg)) {
+			mrz_siphash128(mrz->tokens[t], key, msg, sizeof(msg));
+		} else {
+			memset(mrz->tokens[t], 0, MRZ_TOKEN_LENGTH);
+		}
+	}
+	// The messages hold raw values as well.
+	mrz_wipe(msg, sizeof(msg));
+	mrz_pseudonym_wipe(mrz);
+}
+
+// Hash MRZ_SIPHASH_LANES messages of MRZ_SIPHASH_MESSAGE bytes at once.
+// Like with mrz_sha1_lanes(), every step is done for all lanes in a row
+// so the compiler can map the lanes onto SIMD registers.
+static void mrz_siphash128_lanes(unsigned char (*out)[MRZ_TOKEN_LENGTH],
+		const unsigned char *key,
+		const unsigned char (*msgs)[MRZ_SIPHASH_MESSAGE]) {
+	uint64_t k0 = mrz_load64(key);
+	uint64_t k1 = mrz_load64(key + 8);
+	uint64_t v0[MRZ_SIPHASH_LANES], v1[MRZ_SIPHASH_LANES],
+			v2[MRZ_SIPHASH_LANES], v3[MRZ_SIPHASH_LANES],
+			m[MRZ_SIPHASH_LANES];
+	for (int l = 0; l < MRZ_SIPHASH_LANES; ++l) {
+		v0[l] = k0 ^ 0x736f6d6570736575;
+		v1[l] = k1 ^ 0x646f72616e646f6d ^ 0xee;
+		v2[l] = k0 ^ 0x6c7967656e657261;
+		v3[l] = k1 ^ 0x7465646279746573;
+	}
+	for (int w = 0; w <= MRZ_SIPHASH_WORDS; ++w) {
+		for (int l = 0; l < MRZ_SIPHASH_LANES; ++l) {
+			// The last block only holds the length.
+			m[l] = w < MRZ_SIPHASH_WORDS
+				? mrz_load64(msgs[l] + w * 8)
+				: (uint64_t) MRZ_SIPHASH_MESSAGE << 56;
+			v3[l] ^= m[l];
+		}
+		for (int r = 0; r < 2; ++r) {
+			for (int l = 0; l < MRZ_SIPHASH_LANES; ++l) {
+				MRZ_SIPROUND(v0[l], v1[l], v2[l], v3[l]);
+			}
+		}
+		for (int l = 0; l < MRZ_SIPHASH_LANES; ++l) {
+			v0[l] ^= m[l];
+		}
+	}
+	for (int half = 0; half < 2; ++half) {
+		for (int l = 0; l < MRZ_SIPHASH_LANES; ++l) {
+			if (half) {
+				v1[l] ^= 0xdd;
+			} else {
+				v2[l] ^= 0xee;
+			}
+		}
+		for (int r = 0; r < 4; ++r) {
+			for (int l = 0; l < MRZ_SIPHASH_LANES; ++l) {
+				MRZ_SIPROUND(v0[l], v1[l], v2[l], v3[l]);
+			}
+		}
+		for (int l = 0; l < MRZ_SIPHASH_LANES; ++l) {
+			mrz_store64(out[l] + half * 8, v0[l] ^ v1[l] ^ v2[l] ^ v3[l]);
+		}
+	}
+}
+
+size_t mrz_pseudonymize_batch(MRZ *mrzs, size_t n,
+		const unsigned char *key) {
+	if (!mrzs || !key) {
+		return 0;
+	}
+	unsigned char msgs[MRZ_SIPHASH_LANES][MRZ_SIPHASH_MESSAGE];
+	unsigned char out[MRZ_SIPHASH_LANES][MRZ_TOKEN_LENGTH];
+	unsigned char *dst[MRZ_SIPHASH_LANES];
+	int lanes = 0;
+	// Feed the fields of all records into the lanes and wipe every
+	// record as soon as all of its tokens are written.
+	size_t first = 0;
+	for (size_t i = 0; i < n; ++i) {
+		MRZ *mrz = mrzs + i;
+		for (int t = 0; t < MRZ_TOKENS && !mrz->pseudonymized; ++t) {
+			if (!mrz_pseudonym_message(mrz, t, msgs[lanes])) {
+				memset(mrz->tokens[t], 0, MRZ_TOKEN_LENGTH);
+				continue;
+			}
+			dst[lanes] = mrz->tokens[t];
+			if (++lanes < MRZ_SIPHASH_LANES) {
+				continue;
+			}
+			mrz_siphash128_lanes(out, key,
+					(const unsigned char (*)[MRZ_SIPHASH_MESSAGE]) msgs);
+			for (int l = 0; l < lanes; ++l) {
+				memcpy(dst[l], out[l], MRZ_TOKEN_LENGTH);
+			}
+			lanes = 0;
+			// Everything before the current record is done now.
+			for (; first < i; ++first) {
+				if (!mrzs[first].pseudonymized) {
+					mrz_pseudonym_wipe(mrzs + first);
+				}
+			}
+		}
+	}
+	if (lanes > 0) {
+		// Unused lanes just hash whatever is left in there.
+		mrz_siphash128_lanes(out, key,
+				(const unsigned char (*)[MRZ_SIPHASH_MESSAGE]) msgs);
+		for (int l = 0; l < lanes; ++l) {
+			memcpy(dst[l], out[l], MRZ_TOKEN_LENGTH);
+		}
+	}
+	for (; first < n; ++first) {
+		if (!mrzs[first].pseudonymized) {
+			mrz_pseudonym_wipe(mrzs + first);
+		}
+	}
+	mrz_wipe(msgs, sizeof(msgs));
+	return n;
+}
+#undef MRZ_SIPROUND
+
+// A watchlist index is a single block of memory that can be written to
+// disk and mapped back in as is. It consists of a header, the offsets
+// of all names, the offsets of the posting lists of all trigrams,
+// the posting lists itself and the normalized names. All integers are
+// in native byte order.
+#define MRZ_WATCHLIST_MAGIC 0x575a524d // "MRZW"
+#define MRZ_WATCHLIST_VERSION 1
+#define MRZ_WATCHLIST_SYMBOLS 27 // White space and A-Z.
+#define MRZ_WATCHLIST_GRAMS (MRZ_WATCHLIST_SYMBOLS * \
+		MRZ_WATCHLIST_SYMBOLS * MRZ_WATCHLIST_SYMBOLS)
+#define MRZ_WATCHLIST_MAX_GRAMS (MRZ_WATCHLIST_NAME_MAX + 2)
+
+struct MRZ_WATCHLIST_HEADER {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entries;
+	uint32_t postings;
+	uint32_t name_bytes;
+};
+
+struct MRZ_WATCHLIST {
+	const struct MRZ_WATCHLIST_HEADER *header;
+	const uint32_t *name_offsets;
+	const uint32_t *gram_offsets;
+	const uint32_t *postings;
+	const char *names;
+};
+
+static size_t mrz_watchlist_size(uint32_t entries, uint32_t postings,
+		uint32_t name_bytes) {
+	return sizeof(struct MRZ_WATCHLIST_HEADER) +
+			((size_t) entries + 1 +
+			MRZ_WATCHLIST_GRAMS + 1 +
+			postings) * sizeof(uint32_t) +
+			name_bytes;
+}
+
+static void mrz_watchlist_map(struct MRZ_WATCHLIST *wl, const void *index) {
+	wl->header = index;
+	wl->name_offsets = (const uint32_t *) (wl->header + 1);
+	wl->gram_offsets = wl->name_offsets + wl->header->entries + 1;
+	wl->postings = wl->gram_offsets + MRZ_WATCHLIST_GRAMS + 1;
+	wl->names = (const char *) (wl->postings + wl->header->postings);
+}
+
+static int mrz_watchlist_symbol(char c) {
+	return c > 64 && c < 91 ? c - 64 : 0;
+}
+
+// Join both identifiers with a single white space and drop everything
+// that is not a letter, just like parse_mrz() would.
+static size_t mrz_watchlist_normalize(char *dst, const char *primary,
+		const char *secondary) {
+	size_t len = 0;
+	const char *parts[] = {primary, secondary};
+	for (size_t i = 0; i < MRZ_ARRAY_SIZE(parts); ++i) {
+		for (const char *p = parts[i]; *p; ++p) {
+			char c = mrz_watchlist_symbol(*p) ? *p : *MRZ_WHITE_SPACE;
+			if (len >= MRZ_WATCHLIST_NAME_MAX ||
+					(c == *MRZ_WHITE_SPACE &&
+					(len < 1 || dst[len - 1] == c))) {
+				continue;
+			}
+			dst[len++] = c;
+		}
+		if (len > 0 && len < MRZ_WATCHLIST_NAME_MAX &&
+				dst[len - 1] != *MRZ_WHITE_SPACE) {
+			dst[len++] = *MRZ_WHITE_SPACE;
+		}
+	}
+	for (; len > 0 && dst[len - 1] == *MRZ_WHITE_SPACE; --len);
+	return len;
+}
+
+static int mrz_compare_grams(const void *a, const void *b) {
+	uint32_t l = *(const uint32_t *) a;
+	uint32_t r = *(const uint32_t *) b;
+	return (l > r) - (l < r);
+}
+
+// Collect the distinct trigrams of a name that is padded with two
+// white spaces on both sides.
+static size_t mrz_watchlist_grams(uint32_t *grams, const char *name,
+		size_t len) {
+	size_t n = 0;
+	uint32_t gram = 0;
+	for (size_t i = 0; i < len + 2; ++i) {
+		gram = (gram * MRZ_WATCHLIST_SYMBOLS + (i < len
+				? (uint32_t) mrz_watchlist_symbol(name[i])
+				: 0)) % MRZ_WATCHLIST_GRAMS;
+		grams[n++] = gram;
+	}
+	qsort(grams, n, sizeof(*grams), mrz_compare_grams);
+	size_t distinct = 0;
+	for (size_t i = 0; i < n; ++i) {
+		if (distinct < 1 || grams[distinct - 1] != grams[i]) {
+			grams[distinct++] = grams[i];
+		}
+	}
+	return distinct;
+}
+
+static size_t mrz_watchlist_normalize_entry(char *dst, const char *entry) {
+	// Entries use the notation of the MRZ, so split them exactly like
+	// the identifiers of a MRZ.
+	MRZ mrz;
+	memset(&mrz, 0, sizeof(mrz));
+	mrz_parse_identifiers(&mrz, entry);
+	return mrz_watchlist_normalize(dst, mrz.primary_identifier,
+			mrz.secondary_identifier);
+}
+
+void *mrz_watchlist_build(const char **names, size_t n, size_t *size) {
+	if (!names || !size || n > UINT32_MAX - 1) {
+		return NULL;
+	}
+	uint32_t *counts = calloc(MRZ_WATCHLIST_GRAMS + 1, sizeof(uint32_t));
+	if (!counts) {
+		return NULL;
+	}
+	// First pass to get the size of every section.
+	uint64_t postings = 0;
+	uint64_t name_bytes = 0;
+	for (size_t i = 0; i < n; ++i) {
+		char name[MRZ_WATCHLIST_NAME_MAX];
+		uint32_t grams[MRZ_WATCHLIST_MAX_GRAMS];
+		size_t len = mrz_watchlist_normalize_entry(name, names[i]);
+		size_t ngrams = mrz_watchlist_grams(grams, name, len);
+		for (size_t g = 0; g < ngrams; ++g) {
+			++counts[grams[g]];
+		}
+		postings += ngrams;
+		name_bytes += len;
+	}
+	if (postings > UINT32_MAX || name_bytes > UINT32_MAX) {
+		free(counts);
+		return NULL;
+	}
+	*size = mrz_watchlist_size(n, postings, name_bytes);
+	struct MRZ_WATCHLIST_HEADER *header = calloc(1, *size);
+	if (!header) {
+		free(counts);
+		return NULL;
+	}
+	header->magic = MRZ_WATCHLIST_MAGIC;
+	header->version = MRZ_WATCHLIST_VERSION;
+	header->entries = n;
+	header->postings = postings;
+	header->name_bytes = name_bytes;
+	struct MRZ_WATCHLIST wl;
+	mrz_watchlist_map(&wl, header);
+	uint32_t *name_offsets = (uint32_t *) wl.name_offsets;
+	uint32_t *gram_offsets = (uint32_t *) wl.gram_offsets;
+	uint32_t *posting_lists = (uint32_t *) wl.postings;
+	char *name_data = (char *) wl.names;
+	uint32_t offset = 0;
+	for (size_t g = 0; g < MRZ_WATCHLIST_GRAMS; ++g) {
+		gram_offsets[g] = offset;
+		offset += counts[g];
+		// Reuse counts as insert positions.
+		counts[g] = gram_offsets[g];
+	}
+	gram_offsets[MRZ_WATCHLIST_GRAMS] = offset;
+	// Second pass to fill in the names and posting lists. Entries
+	// are processed in order so every posting list is sorted.
+	offset = 0;
+	for (size_t i = 0; i < n; ++i) {
+		char name[MRZ_WATCHLIST_NAME_MAX];
+		uint32_t grams[MRZ_WATCHLIST_MAX_GRAMS];
+		size_t len = mrz_watchlist_normalize_entry(name, names[i]);
+		size_t ngrams = mrz_watchlist_grams(grams, name, len);
+		for (size_t g = 0; g < ngrams; ++g) {
+			posting_lists[counts[grams[g]]++] = i;
+		}
+		name_offsets[i] = offset;
+		memcpy(name_data + offset, name, len);
+		offset += len;
+	}
+	name_offsets[n] = offset;
+	free(counts);
+	return header;
+}
+
+int mrz_watchlist_check(const void *index, size_t size) {
+	const struct MRZ_WATCHLIST_HEADER *header = index;
+	if (!index || size < sizeof(*header) ||
+			(uintptr_t) index % sizeof(uint32_t) ||
+			header->magic != MRZ_WATCHLIST_MAGIC ||
+			header->version != MRZ_WATCHLIST_VERSION ||
+			size != mrz_watchlist_size(header->entries,
+					header->postings, header->name_bytes)) {
+		return 0;
+	}
+	struct MRZ_WATCHLIST wl;
+	mrz_watchlist_map(&wl, index);
+	// Make sure offsets can be trusted without checking them again.
+	for (uint32_t i = 0; i < header->entries; ++i) {
+		if (wl.name_offsets[i] > wl.name_offsets[i + 1] ||
+				wl.name_offsets[i + 1] - wl.name_offsets[i] >
+						MRZ_WATCHLIST_NAME_MAX) {
+			return 0;
+		}
+	}
+	if (wl.name_offsets[0] != 0 ||
+			wl.name_offsets[header->entries] != header->name_bytes) {
+		return 0;
+	}
+	for (uint32_t g = 0; g < MRZ_WATCHLIST_GRAMS; ++g) {
+		if (wl.gram_offsets[g] > wl.gram_offsets[g + 1]) {
+			return 0;
+		}
+	}
+	if (wl.gram_offsets[0] != 0 ||
+			wl.gram_offsets[MRZ_WATCHLIST_GRAMS] != header->postings) {
+		return 0;
+	}
+	for (uint32_t i = 0; i < header->postings; ++i) {
+		if (wl.postings[i] >= header->entries) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Bounded Levenshtein distance with the bit-parallel algorithm of
+// Myers/Hyyrö. The whole pattern fits in one 64 bit word so every text
+// character updates all pattern positions at once. Returns a value
+// greater than max if the distance exceeds max.
+static int mrz_watchlist_distance(const uint64_t *peq, size_t m,
+		const char *text, size_t n, int max) {
+	if (m < 1) {
+		return (int) n;
+	}
+	uint64_t pv = ~(uint64_t) 0;
+	uint64_t mv = 0;
+	uint64_t high = (uint64_t) 1 << (m - 1);
+	int score = (int) m;
+	for (size_t j = 0; j < n; ++j) {
+		uint64_t eq = peq[mrz_watchlist_symbol(text[j])];
+		uint64_t xv = eq | mv;
+		uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+		uint64_t ph = mv | ~(xh | pv);
+		uint64_t mh = pv & xh;
+		if (ph & high) {
+			++score;
+		} else if (mh & high) {
+			--score;
+		}
+		ph = (ph << 1) | 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+		// The score can decrease by one per remaining character at most.
+		if (score - (int) (n - j - 1) > max) {
+			return max + 1;
+		}
+	}
+	return score;
+}
+
+struct MRZ_WATCHLIST_CURSOR {
+	const uint32_t *p;
+	const uint32_t *end;
+};
+
+static void mrz_watchlist_sift(struct MRZ_WATCHLIST_CURSOR *heap,
+		size_t n, size_t i) {
+	for (;;) {
+		size_t min = i;
+		size_t l = i * 2 + 1;
+		size_t r = l + 1;
+		if (l < n && *heap[l].p < *heap[min].p) {
+			min = l;
+		}
+		if (r < n && *heap[r].p < *heap[min].p) {
+			min = r;
+		}
+		if (min == i) {
+			break;
+		}
+		struct MRZ_WATCHLIST_CURSOR tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+static int mrz_compare_cursor_length(const void *a, const void *b) {
+	const struct MRZ_WATCHLIST_CURSOR *l = a;
+	const struct MRZ_WATCHLIST_CURSOR *r = b;
+	ptrdiff_t ll = l->end - l->p;
+	ptrdiff_t rl = r->end - r->p;
+	return (ll > rl) - (ll < rl);
+}
+
+static size_t mrz_watchlist_add_hit(MRZ_WATCHLIST_HIT *hits,
+		size_t nhits, size_t max_hits, uint32_t entry, int distance) {
+	// Keep hits sorted by distance and drop the worst one if full.
+	if (nhits == max_hits) {
+		if (hits[nhits - 1].distance <= distance) {
+			return nhits;
+		}
+		--nhits;
+	}
+	size_t i = nhits;
+	for (; i > 0 && hits[i - 1].distance > distance; --i) {
+		hits[i] = hits[i - 1];
+	}
+	hits[i].entry = entry;
+	hits[i].distance = distance;
+	return nhits + 1;
+}
+
+static size_t mrz_watchlist_verify(const struct MRZ_WATCHLIST *wl,
+		uint32_t entry, const uint64_t *peq, size_t m, int max_distance,
+		MRZ_WATCHLIST_HIT *hits, size_t nhits, size_t max_hits) {
+	const char *name = wl->names + wl->name_offsets[entry];
+	size_t n = wl->name_offsets[entry + 1] - wl->name_offsets[entry];
+	if ((m > n ? m - n : n - m) > (size_t) max_distance) {
+		return nhits;
+	}
+	int distance = mrz_watchlist_distance(peq, m, name, n, max_distance);
+	if (distance > max_distance) {
+		return nhits;
+	}
+	return mrz_watchlist_add_hit(hits, nhits, max_hits, entry, distance);
+}
+
+size_t mrz_watchlist_query(const void *index, const MRZ *mrz,
+		int max_distance, MRZ_WATCHLIST_HIT *hits, size_t max_hits) {
+	if (!index || !mrz || !hits || max_hits < 1 || max_distance < 0) {
+		return 0;
+	}
+	struct MRZ_WATCHLIST wl;
+	mrz_watchlist_map(&wl, index);
+	char name[MRZ_WATCHLIST_NAME_MAX];
+	size_t m = mrz_watchlist_normalize(name, mrz->primary_identifier,
+			mrz->secondary_identifier);
+	uint64_t peq[MRZ_WATCHLIST_SYMBOLS] = {0};
+	for (size_t i = 0; i < m; ++i) {
+		peq[mrz_watchlist_symbol(name[i])] |= (uint64_t) 1 << i;
+	}
+	uint32_t grams[MRZ_WATCHLIST_MAX_GRAMS];
+	size_t ngrams = mrz_watchlist_grams(grams, name, m);
+	// Every edit operation destroys three trigrams at most, so a name
+	// within max_distance shares at least that many trigrams.
+	int threshold = (int) ngrams - 3 * max_distance;
+	size_t nhits = 0;
+	if (threshold < 1) {
+		// Too short for filtering, so there's nothing but to check
+		// every entry. See the declaration for the cutoff.
+		for (uint32_t i = 0; i < wl.header->entries; ++i) {
+			nhits = mrz_watchlist_verify(&wl, i, peq, m, max_distance,
+					hits, nhits, max_hits);
+		}
+		return nhits;
+	}
+	struct MRZ_WATCHLIST_CURSOR heap[MRZ_WATCHLIST_MAX_GRAMS];
+	size_t nheap = 0;
+	for (size_t g = 0; g < ngrams; ++g) {
+		heap[nheap].p = wl.postings + wl.gram_offsets[grams[g]];
+		heap[nheap].end = wl.postings + wl.gram_offsets[grams[g] + 1];
+		nheap += heap[nheap].p < heap[nheap].end;
+	}
+	// Skip the longest posting lists as long as the remaining ones
+	// still need to share a trigram with every match. This trades
+	// merging very common trigrams for verifying a few more entries.
+	qsort(heap, nheap, sizeof(*heap), mrz_compare_cursor_length);
+	size_t skip = (size_t) threshold / 2;
+	if (skip > nheap) {
+		skip = nheap;
+	}
+	nheap -= skip;
+	threshold -= (int) skip;
+	for (size_t i = nheap; i-- > 0; ) {
+		mrz_watchlist_sift(heap, nheap, i);
+	}
+	// Merge all posting lists and count how often each entry occurs.
+	while (nheap > 0) {
+		uint32_t entry = *heap[0].p;
+		int count = 0;
+		while (nheap > 0 && *heap[0].p == entry) {
+			++count;
+			if (++heap[0].p == heap[0].end) {
+				heap[0] = heap[--nheap];
+			}
+			mrz_watchlist_sift(heap, nheap, 0);
+		}
+		if (count >= threshold) {
+			nhits = mrz_watchlist_verify(&wl, entry, peq, m, max_distance,
+					hits, nhits, max_hits);
+		}
+	}
+	return nhits;
+}
+
+// A store is an open addressing hash table of fixed size records that
+// is meant to live in a memory mapped file. Records are never moved or
+// removed, new records only fill empty slots. A slot is empty as long
+// as its hash is zero, which is why the hash is written last.
+#define MRZ_STORE_MAGIC 0x535a524d // "MRZS"
+#define MRZ_STORE_VERSION 1
+
+struct MRZ_STORE_HEADER {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;
+	uint64_t count;
+};
+
+// A record becomes visible when its hash is set, so the hash must be
+// stored after the rest of the record and loaded before it. That's
+// what lets readers use a store while it's being written to.
+#if defined(__GNUC__) || defined(__clang__)
+#define MRZ_STORE_PUBLISH(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define MRZ_STORE_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#else
+#define MRZ_STORE_PUBLISH(p, v) (*(volatile uint64_t *) (p) = (v))
+#define MRZ_STORE_LOAD(p) (*(const volatile uint64_t *) (p))
+#endif
+
+static uint64_t mrz_store_hash(const char *issuing_state,
+		const char *document_number) {
+	// FNV-1a over both keys, including their terminating zeros.
+	uint64_t h = 0xcbf29ce484222325;
+	const char *keys[] = {issuing_state, document_number};
+	for (size_t i = 0; i < MRZ_ARRAY_SIZE(keys); ++i) {
+		const char *p = keys[i];
+		do {
+			h ^= (unsigned char) *p;
+			h *= 0x100000001b3;
+		} while (*p++);
+	}
+	return h ? h : 1;
+}
+
+static MRZ_STORE_RECORD *mrz_store_records(const void *store) {
+	return (MRZ_STORE_RECORD *) ((const struct MRZ_STORE_HEADER *)
+			store + 1);
+}
+
+size_t mrz_store_size(uint64_t capacity) {
+	return sizeof(struct MRZ_STORE_HEADER) +
+			capacity * sizeof(MRZ_STORE_RECORD);
+}
+
+void mrz_store_init(void *store, uint64_t capacity) {
+	// Capacity must be a power of two.
+	memset(store, 0, mrz_store_size(capacity));
+	struct MRZ_STORE_HEADER *header = store;
+	header->magic = MRZ_STORE_MAGIC;
+	header->version = MRZ_STORE_VERSION;
+	header->capacity = capacity;
+}
+
+#define MRZ_STORE_TERMINATED(field) \
+	memchr(r->field, 0, sizeof(r->field))
+int mrz_store_check(const void *store, size_t size) {
+	const struct MRZ_STORE_HEADER *header = store;
+	if (!store || size < sizeof(*header) ||
+			(uintptr_t) store % sizeof(uint64_t) != 0 ||
+			header->magic != MRZ_STORE_MAGIC ||
+			header->version != MRZ_STORE_VERSION ||
+			header->capacity < 1 ||
+			(header->capacity & (header->capacity - 1)) != 0 ||
+			header->capacity > (size - sizeof(*header)) /
+					sizeof(MRZ_STORE_RECORD) ||
+			size != mrz_store_size(header->capacity) ||
+			header->count > header->capacity) {
+		return 0;
+	}
+	// Lookups compare strings, which must not run past their field.
+	const MRZ_STORE_RECORD *r = mrz_store_records(store);
+	for (uint64_t i = 0; i < header->capacity; ++i, ++r) {
+		if (!MRZ_STORE_TERMINATED(issuing_state) ||
+				!MRZ_STORE_TERMINATED(document_number) ||
+				!MRZ_STORE_TERMINATED(document_code) ||
+				!MRZ_STORE_TERMINATED(nationality) ||
+				!MRZ_STORE_TERMINATED(date_of_birth) ||
+				!MRZ_STORE_TERMINATED(date_of_expiry) ||
+				!MRZ_STORE_TERMINATED(sex) ||
+				!MRZ_STORE_TERMINATED(primary_identifier) ||
+				!MRZ_STORE_TERMINATED(secondary_identifier)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+#undef MRZ_STORE_TERMINATED
+
+uint64_t mrz_store_count(const void *store) {
+	const struct MRZ_STORE_HEADER *header = store;
+	return MRZ_STORE_LOAD(&header->count);
+}
+
+static MRZ_STORE_RECORD *mrz_store_probe(const void *store, uint64_t hash,
+		const char *issuing_state, const char *document_number) {
+	const struct MRZ_STORE_HEADER *header = store;
+	MRZ_STORE_RECORD *records = mrz_store_records(store);
+	uint64_t mask = header->capacity - 1;
+	for (uint64_t i = hash & mask, n = 0; n < header->capacity;
+			i = (i + 1) & mask, ++n) {
+		MRZ_STORE_RECORD *r = records + i;
+		uint64_t h = MRZ_STORE_LOAD(&r->hash);
+		if (!h || (h == hash &&
+				!strcmp(r->issuing_state, issuing_state) &&
+				!strcmp(r->document_number, document_number))) {
+			return r;
+		}
+	}
+	return NULL;
+}
+
+const MRZ_STORE_RECORD *mrz_store_find(const void *store,
+		const char *issuing_state, const char *document_number) {
+	if (!store || !issuing_state || !document_number) {
+		return NULL;
+	}
+	const MRZ_STORE_RECORD *r = mrz_store_probe(store,
+			mrz_store_hash(issuing_state, document_number),
+			issuing_state, document_number);
+	return r && MRZ_STORE_LOAD(&r->hash) ? r : NULL;
+}
+
+static int mrz_store_put(void *store, const MRZ_STORE_RECORD *record) {
+	struct MRZ_STORE_HEADER *header = store;
+	MRZ_STORE_RECORD *r = mrz_store_probe(store, record->hash,
+			record->issuing_state, record->document_number);
+	if (r && r->hash) {
+		return MRZ_STORE_EXISTS;
+	}
+	// Keep the load factor below 3/4 to keep probe sequences short.
+	if (!r || header->count + 1 > header->capacity / 4 * 3) {
+		return MRZ_STORE_FULL;
+	}
+	memcpy((char *) r + sizeof(r->hash),
+			(const char *) record + sizeof(record->hash),
+			sizeof(*r) - sizeof(r->hash));
+	MRZ_STORE_PUBLISH(&r->hash, record->hash);
+	MRZ_STORE_PUBLISH(&header->count, header->count + 1);
+	return MRZ_STORE_INSERTED;
+}
+
+// Copy only up to the terminating null, because a reused parser
+// context leaves bytes of earlier documents behind it.
+static void mrz_store_copy(char *dst, const char *src, size_t cap) {
+	size_t len = strlen(src);
+	memcpy(dst, src, len < cap ? len : cap - 1);
+}
+
+#define MRZ_STORE_COPY(field) \
+	mrz_store_copy(record.field, mrz->field, sizeof(record.field))
+int mrz_store_insert(void *store, const MRZ *mrz) {
+	if (!store || !mrz) {
+		return MRZ_STORE_FULL;
+	}
+	MRZ_STORE_RECORD record;
+	memset(&record, 0, sizeof(record));
+	MRZ_STORE_COPY(issuing_state);
+	MRZ_STORE_COPY(document_number);
+	MRZ_STORE_COPY(document_code);
+	MRZ_STORE_COPY(nationality);
+	MRZ_STORE_COPY(date_of_birth);
+	MRZ_STORE_COPY(date_of_expiry);
+	MRZ_STORE_COPY(sex);
+	MRZ_STORE_COPY(primary_identifier);
+	MRZ_STORE_COPY(secondary_identifier);
+	// France doesn't set an issuing state, so use the nationality.
+	if (!*record.issuing_state) {
+		memcpy(record.issuing_state, record.nationality,
+				sizeof(record.issuing_state));
+	}
+	record.hash = mrz_store_hash(record.issuing_state,
+			record.document_number);
+	return mrz_store_put(store, &record);
+}
+#undef MRZ_STORE_COPY
+
+int mrz_store_grow(void *dst, const void *src) {
+	// Copy all records of src into the freshly initialized store dst.
+	const struct MRZ_STORE_HEADER *header = src;
+	const MRZ_STORE_RECORD *records = mrz_store_records(src);
+	for (uint64_t i = 0; i < header->capacity; ++i) {
+		if (records[i].hash &&
+				mrz_store_put(dst, records + i) != MRZ_STORE_INSERTED) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// A columnar file begins with a header that is followed by row groups.
+// Every row group holds one block per column with fixed width values
+// for all its rows. A footer with the offset and number of rows of
+// every group and a trailer that points to the footer end the file.
+// All blocks are aligned to 8 bytes, so columns can be used right from
+// a memory mapped file.
+#define MRZ_COLUMNS_MAGIC 0x435a524d // "MRZC"
+#define MRZ_COLUMNS_VERSION 2
+#define MRZ_COLUMNS_ALIGN(n) (((n) + 7) & ~(size_t) 7)
+
+struct MRZ_COLUMNS_HEADER {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t columns;
+	uint32_t reserved;
+};
+
+struct MRZ_COLUMNS_TRAILER {
+	uint64_t groups;
+	uint64_t footer;
+	uint32_t magic;
+	uint32_t version;
+};
+
+#define MRZ_COLUMN_STRING(field) \
+	{offsetof(MRZ, field), MRZ_CAPACITY(((MRZ *) 0)->field), 1}
+static const struct {
+	size_t offset;
+	size_t width;
+	// Strings are padded with zeros, everything else is copied as is.
+	int string;
+} mrz_column_layout[MRZ_COLUMN_COUNT] = {
+	MRZ_COLUMN_STRING(document_code),
+	MRZ_COLUMN_STRING(issuing_state),
+	MRZ_COLUMN_STRING(primary_identifier),
+	MRZ_COLUMN_STRING(secondary_identifier),
+	MRZ_COLUMN_STRING(nationality),
+	MRZ_COLUMN_STRING(document_number),
+	{offsetof(MRZ, printed_date_of_birth), sizeof(int32_t), 0},
+	MRZ_COLUMN_STRING(sex),
+	{offsetof(MRZ, printed_date_of_expiry), sizeof(int32_t), 0},
+	MRZ_COLUMN_STRING(optional_data1),
+	MRZ_COLUMN_STRING(optional_data2),
+	MRZ_COLUMN_STRING(blank_number),
+	MRZ_COLUMN_STRING(language),
+	{offsetof(MRZ, error_mask), sizeof(uint64_t), 0},
+	{offsetof(MRZ, tokens), MRZ_TOKENS * MRZ_TOKEN_LENGTH, 0},
+};
+#undef MRZ_COLUMN_STRING
+
+size_t mrz_columns_width(int column) {
+	return column > -1 && column < MRZ_COLUMN_COUNT
+		? mrz_column_layout[column].width
+		: 0;
+}
+
+size_t mrz_columns_header(void *buf) {
+	struct MRZ_COLUMNS_HEADER header = {
+		MRZ_COLUMNS_MAGIC, MRZ_COLUMNS_VERSION, MRZ_COLUMN_COUNT, 0
+	};
+	memcpy(buf, &header, sizeof(header));
+	return sizeof(header);
+}
+
+static size_t mrz_columns_block_offset(uint64_t rows, int column) {
+	size_t offset = 0;
+	for (int i = 0; i < column; ++i) {
+		offset += MRZ_COLUMNS_ALIGN(mrz_column_layout[i].width * rows);
+	}
+	return offset;
+}
+
+size_t mrz_columns_group_size(uint64_t rows) {
+	return mrz_columns_block_offset(rows, MRZ_COLUMN_COUNT);
+}
+
+// Encode a date as printed, so unknown parts become zeros in place.
+static int32_t mrz_encode_date(const char *s) {
+	int32_t date = 0;
+	int digits = 0;
+	for (int i = 0; i < 6; ++i) {
+		date *= 10;
+		if (*s) {
+			if (*s >= '0' && *s <= '9') {
+				date += *s - '0';
+				++digits;
+			}
+			++s;
+		}
+	}
+	return digits > 0 ? date : MRZ_COLUMNS_NO_DATE;
+}
+
+void mrz_columns_group(void *group, const MRZ *mrzs, uint64_t rows) {
+	unsigned char *block = group;
+	memset(group, 0, mrz_columns_group_size(rows));
+	for (int c = 0; c < MRZ_COLUMN_COUNT; ++c) {
+		size_t offset = mrz_column_layout[c].offset;
+		size_t width = mrz_column_layout[c].width;
+		for (uint64_t r = 0; r < rows; ++r) {
+			const char *field = (const char *) (mrzs + r) + offset;
+			unsigned char *dst = block + r * width;
+			if (c == MRZ_COLUMN_DATE_OF_BIRTH ||
+					c == MRZ_COLUMN_DATE_OF_EXPIRY) {
+				int32_t date = mrz_encode_date(field);
+				memcpy(dst, &date, sizeof(date));
+			} else if (c == MRZ_COLUMN_TOKENS && !mrzs[r].pseudonymized) {
+				continue;
+			} else if (mrz_column_layout[c].string) {
+				strncpy((char *) dst, field, width);
+			} else {
+				memcpy(dst, field, width);
+			}
+		}
+		block += MRZ_COLUMNS_ALIGN(width * rows);
+	}
+}
+
+size_t mrz_columns_footer_size(uint64_t groups) {
+	return groups * 2 * sizeof(uint64_t) +
+			sizeof(struct MRZ_COLUMNS_TRAILER);
+}
+
+void mrz_columns_footer(void *buf, const uint64_t *offsets,
+		const uint64_t *rows, uint64_t groups) {
+	// The footer follows the last group.
+	uint64_t footer = groups > 0
+		? offsets[groups - 1] + mrz_columns_group_size(rows[groups - 1])
+		: sizeof(struct MRZ_COLUMNS_HEADER);
+	uint64_t *index = buf;
+	for (uint64_t i = 0; i < groups; ++i) {
+		*index++ = offsets[i];
+		*index++ = rows[i];
+	}
+	struct MRZ_COLUMNS_TRAILER trailer = {
+		groups, footer, MRZ_COLUMNS_MAGIC, MRZ_COLUMNS_VERSION
+	};
+	memcpy(index, &trailer, sizeof(trailer));
+}
+
+int mrz_columns_open(MRZ_COLUMNS *columns, const void *data, size_t size) {
+	const struct MRZ_COLUMNS_HEADER *header = data;
+	if (!columns || !data ||
+			(uintptr_t) data % sizeof(uint64_t) ||
+			size < sizeof(*header) + sizeof(struct MRZ_COLUMNS_TRAILER) ||
+			header->magic != MRZ_COLUMNS_MAGIC ||
+			header->version != MRZ_COLUMNS_VERSION ||
+			header->columns != MRZ_COLUMN_COUNT) {
+		return 0;
+	}
+	const struct MRZ_COLUMNS_TRAILER *trailer =
+			(const void *) ((const char *) data + size - sizeof(*trailer));
+	if (trailer->magic != MRZ_COLUMNS_MAGIC ||
+			trailer->version != MRZ_COLUMNS_VERSION ||
+			trailer->footer % sizeof(uint64_t) ||
+			trailer->footer < sizeof(*header) ||
+			trailer->footer > size ||
+			trailer->groups > size / (2 * sizeof(uint64_t)) ||
+			trailer->footer + mrz_columns_footer_size(trailer->groups) !=
+					size) {
+		return 0;
+	}
+	const uint64_t *index = (const uint64_t *) ((const char *) data +
+			trailer->footer);
+	uint64_t rows = 0;
+	uint64_t end = sizeof(*header);
+	for (uint64_t i = 0; i < trailer->groups; ++i) {
+		uint64_t offset = index[i * 2];
+		uint64_t n = index[i * 2 + 1];
+		// Groups must not overlap each other or the footer. Test the
+		// offset first, so the subtraction can't wrap.
+		if (offset < end || offset % sizeof(uint64_t) ||
+				offset > trailer->footer || n > trailer->footer ||
+				mrz_columns_group_size(n) > trailer->footer - offset) {
+			return 0;
+		}
+		end = offset + mrz_columns_group_size(n);
+		if (end < offset) {
+			return 0;
+		}
+		rows += n;
+	}
+	columns->data = data;
+	columns->groups = trailer->groups;
+	columns->rows = rows;
+	columns->index = index;
+	return 1;
+}
+
+const void *mrz_columns_block(const MRZ_COLUMNS *columns, uint64_t group,
+		int column, uint64_t *rows) {
+	if (group >= columns->groups || column < 0 ||
+			column >= MRZ_COLUMN_COUNT) {
+		return NULL;
+	}
+	uint64_t n = columns->index[group * 2 + 1];
+	if (rows) {
+		*rows = n;
+	}
+	return columns->data + columns->index[group * 2] +
+			mrz_columns_block_offset(n, column);
+}
+
+void mrz_columns_cursor(MRZ_COLUMNS_CURSOR *cursor,
+		const MRZ_COLUMNS *columns) {
+	memset(cursor, 0, sizeof(*cursor));
+	cursor->columns = columns;
+	cursor->group = (uint64_t) -1;
+}
+
+int mrz_columns_next(MRZ_COLUMNS_CURSOR *cursor) {
+	if (cursor->row + 1 < cursor->rows) {
+		++cursor->row;
+		return 1;
+	}
+	// Skip to the next group that isn't empty.
+	const MRZ_COLUMNS *columns = cursor->columns;
+	while (++cursor->group < columns->groups) {
+		for (int c = 0; c < MRZ_COLUMN_COUNT; ++c) {
+			cursor->blocks[c] = mrz_columns_block(columns, cursor->group,
+					c, &cursor->rows);
+		}
+		if (cursor->rows > 0) {
+			cursor->row = 0;
+			return 1;
+		}
+	}
+	cursor->group = columns->groups;
+	cursor->rows = 0;
+	return 0;
+}
+
+const char *mrz_columns_string(const MRZ_COLUMNS_CURSOR *cursor,
+		int column, size_t *len) {
+	if (column < 0 || column >= MRZ_COLUMN_COUNT ||
+			column == MRZ_COLUMN_DATE_OF_BIRTH ||
+			column == MRZ_COLUMN_DATE_OF_EXPIRY ||
+			column == MRZ_COLUMN_ERRORS ||
+			column == MRZ_COLUMN_TOKENS) {
+		return NULL;
+	}
+	size_t width = mrz_column_layout[column].width;
+	const char *s = (const char *) cursor->blocks[column] +
+			cursor->row * width;
+	if (len) {
+		const char *z = memchr(s, 0, width);
+		*len = z ? (size_t) (z - s) : width;
+	}
+	return s;
+}
+
+int32_t mrz_columns_date(const MRZ_COLUMNS_CURSOR *cursor, int column) {
+	if (column != MRZ_COLUMN_DATE_OF_BIRTH &&
+			column != MRZ_COLUMN_DATE_OF_EXPIRY) {
+		return MRZ_COLUMNS_NO_DATE;
+	}
+	int32_t date;
+	memcpy(&date, cursor->blocks[column] + cursor->row * sizeof(date),
+			sizeof(date));
+	return date;
+}
+
+uint64_t mrz_columns_errors(const MRZ_COLUMNS_CURSOR *cursor) {
+	uint64_t mask;
+	memcpy(&mask, cursor->blocks[MRZ_COLUMN_ERRORS] +
+			cursor->row * sizeof(mask), sizeof(mask));
+	return mask;
+}
+
+const unsigned char *mrz_columns_token(const MRZ_COLUMNS_CURSOR *cursor,
+		int token) {
+	if (token < 0 || token >= MRZ_TOKENS) {
+		return NULL;
+	}
+	return cursor->blocks[MRZ_COLUMN_TOKENS] +
+			cursor->row * MRZ_TOKENS * MRZ_TOKEN_LENGTH +
+			token * MRZ_TOKEN_LENGTH;
+}
 #endif // MRZ_PARSER_IMPLEMENTATION
 
 #endif
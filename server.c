@@ -0,0 +1,459 @@
+#define _POSIX_C_SOURCE 200809L
+#include "server.h"
+#include "input.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+struct connection;
+
+struct job {
+	struct connection *conn;
+	// Next job in the queue of the workers.
+	struct job *next;
+	// Next job of the same connection in request order, or the next
+	// free job.
+	struct job *next_out;
+	int done;
+	// Set if the last request was too long or malformed.
+	int failed;
+	size_t count;
+	char *records[SERVER_BATCH_MAX];
+	char *out;
+	size_t out_len;
+	char data[];
+};
+
+struct connection {
+	struct server *server;
+	int out;
+	int broken;
+	// Set when no more jobs will be submitted.
+	int closing;
+	pthread_mutex_t mutex;
+	// Signalled when a job was written and is free again.
+	pthread_cond_t cond;
+	// Signalled when a job is done or the connection is closing.
+	pthread_cond_t ready;
+	// Jobs in request order.
+	struct job *head;
+	struct job *tail;
+	unsigned pending;
+	struct job *free;
+	struct input in;
+};
+
+struct server {
+	int framing;
+	int lines;
+	size_t max_record;
+	server_handler handler;
+	void *user;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct job *queue;
+	struct job *queue_tail;
+	int stopping;
+	// Open connections of server_listen().
+	unsigned connections;
+	// Signalled when a connection was closed.
+	pthread_cond_t closed;
+	unsigned workers;
+	struct worker *args;
+	pthread_t threads[];
+};
+
+static int write_all(int fd, const char *p, size_t n) {
+	while (n > 0) {
+		ssize_t w = write(fd, p, n);
+		if (w < 0 && errno == EINTR) {
+			continue;
+		} else if (w < 1) {
+			return 0;
+		}
+		p += w;
+		n -= w;
+	}
+	return 1;
+}
+
+// Write the responses of finished jobs in request order until the
+// connection is closing and all jobs are written. Runs on a thread of
+// its own, so neither a worker nor the reading thread blocks when a
+// client doesn't read its responses. Writes without holding the mutex.
+static void *write_responses(void *arg) {
+	struct connection *conn = arg;
+	pthread_mutex_lock(&conn->mutex);
+	for (;;) {
+		struct job *job = conn->head;
+		if (!job || !job->done) {
+			if (!job && conn->closing) {
+				break;
+			}
+			pthread_cond_wait(&conn->ready, &conn->mutex);
+			continue;
+		}
+		conn->head = job->next_out;
+		if (!conn->head) {
+			conn->tail = NULL;
+		}
+		int broken = conn->broken;
+		pthread_mutex_unlock(&conn->mutex);
+		if (!broken && !write_all(conn->out, job->out, job->out_len)) {
+			broken = 1;
+		}
+		pthread_mutex_lock(&conn->mutex);
+		conn->broken = broken;
+		job->next_out = conn->free;
+		conn->free = job;
+		--conn->pending;
+		pthread_cond_signal(&conn->cond);
+	}
+	pthread_mutex_unlock(&conn->mutex);
+	return NULL;
+}
+
+static char *frame_response(struct server *server, char *o, size_t n) {
+	if (server->framing == FRAMING_LENGTH) {
+		memmove(o + 4, o, n);
+		o[0] = n >> 24;
+		o[1] = n >> 16;
+		o[2] = n >> 8;
+		o[3] = n;
+		return o + 4 + n;
+	}
+	o[n] = '\n';
+	return o + n + 1;
+}
+
+static void answer(struct server *server, unsigned worker,
+		struct job *job) {
+	char *o = job->out;
+	for (size_t i = 0; i < job->count; ++i) {
+		o = frame_response(server, o, server->handler(job->records[i], o,
+				SERVER_RESPONSE_MAX, worker, server->user));
+	}
+	if (job->failed) {
+		int n = snprintf(o, SERVER_RESPONSE_MAX,
+				"FAILED\trecord longer than %zu bytes or truncated",
+				server->max_record);
+		o = frame_response(server, o, n);
+	}
+	job->out_len = o - job->out;
+}
+
+struct worker {
+	struct server *server;
+	unsigned index;
+};
+
+static void *work(void *arg) {
+	struct worker *worker = arg;
+	struct server *server = worker->server;
+	for (;;) {
+		pthread_mutex_lock(&server->mutex);
+		while (!server->queue && !server->stopping) {
+			pthread_cond_wait(&server->cond, &server->mutex);
+		}
+		struct job *job = server->queue;
+		if (job) {
+			server->queue = job->next;
+			if (!server->queue) {
+				server->queue_tail = NULL;
+			}
+		}
+		pthread_mutex_unlock(&server->mutex);
+		if (!job) {
+			return NULL;
+		}
+		answer(server, worker->index, job);
+		struct connection *conn = job->conn;
+		pthread_mutex_lock(&conn->mutex);
+		job->done = 1;
+		if (job == conn->head) {
+			pthread_cond_signal(&conn->ready);
+		}
+		pthread_mutex_unlock(&conn->mutex);
+	}
+}
+
+// Get a free job for the next batch. Blocks while too many batches of
+// this connection are in flight.
+static struct job *take_job(struct connection *conn) {
+	pthread_mutex_lock(&conn->mutex);
+	while (conn->pending >= SERVER_PENDING_MAX && !conn->broken) {
+		pthread_cond_wait(&conn->cond, &conn->mutex);
+	}
+	int broken = conn->broken;
+	struct job *job = conn->free;
+	if (job && !broken) {
+		conn->free = job->next_out;
+	}
+	pthread_mutex_unlock(&conn->mutex);
+	if (broken) {
+		return NULL;
+	}
+	if (!job) {
+		size_t records = SERVER_BATCH_MAX * (conn->server->max_record + 1);
+		// Room for the framing of every response and one more for
+		// the error.
+		size_t responses = (SERVER_BATCH_MAX + 1) *
+				(SERVER_RESPONSE_MAX + 4);
+		if (!(job = malloc(sizeof(struct job) + records + responses))) {
+			return NULL;
+		}
+		job->out = job->data + records;
+	}
+	job->conn = conn;
+	job->next = NULL;
+	job->next_out = NULL;
+	job->done = 0;
+	job->failed = 0;
+	job->count = 0;
+	job->out_len = 0;
+	return job;
+}
+
+static void submit(struct connection *conn, struct job *job) {
+	pthread_mutex_lock(&conn->mutex);
+	if (conn->tail) {
+		conn->tail->next_out = job;
+	} else {
+		conn->head = job;
+	}
+	conn->tail = job;
+	++conn->pending;
+	pthread_mutex_unlock(&conn->mutex);
+	struct server *server = conn->server;
+	pthread_mutex_lock(&server->mutex);
+	if (server->queue_tail) {
+		server->queue_tail->next = job;
+	} else {
+		server->queue = job;
+	}
+	server->queue_tail = job;
+	pthread_cond_signal(&server->cond);
+	pthread_mutex_unlock(&server->mutex);
+}
+
+int server_run(struct server *server, int in, int out) {
+	struct connection *conn = calloc(1, sizeof(struct connection));
+	if (!conn) {
+		return -1;
+	}
+	conn->server = server;
+	conn->out = out;
+	pthread_mutex_init(&conn->mutex, NULL);
+	pthread_cond_init(&conn->cond, NULL);
+	pthread_cond_init(&conn->ready, NULL);
+	pthread_t writer;
+	if (pthread_create(&writer, NULL, write_responses, conn)) {
+		pthread_cond_destroy(&conn->ready);
+		pthread_cond_destroy(&conn->cond);
+		pthread_mutex_destroy(&conn->mutex);
+		free(conn);
+		return -1;
+	}
+	input_open(&conn->in, in, server->framing, server->lines,
+			server->max_record, 0, -1);
+	int status = 0;
+	char *record;
+	do {
+		struct job *job = take_job(conn);
+		if (!job) {
+			status = -1;
+			break;
+		}
+		// Add requests to the batch as long as they are buffered
+		// already. Under load, more requests arrive with every read.
+		char *d = job->data;
+		size_t len;
+		int too_long = 0;
+		while ((record = input_next(&conn->in, &len, &too_long)) &&
+				!too_long) {
+			memcpy(d, record, len + 1);
+			job->records[job->count++] = d;
+			d += len + 1;
+			if (job->count >= SERVER_BATCH_MAX ||
+					!input_ready(&conn->in)) {
+				break;
+			}
+		}
+		if (too_long) {
+			job->failed = 1;
+			status = -1;
+			record = NULL;
+		}
+		if (job->count > 0 || job->failed) {
+			submit(conn, job);
+		} else {
+			pthread_mutex_lock(&conn->mutex);
+			job->next_out = conn->free;
+			conn->free = job;
+			pthread_mutex_unlock(&conn->mutex);
+		}
+	} while (record);
+	pthread_mutex_lock(&conn->mutex);
+	conn->closing = 1;
+	pthread_cond_signal(&conn->ready);
+	pthread_mutex_unlock(&conn->mutex);
+	pthread_join(writer, NULL);
+	if (conn->broken) {
+		status = -1;
+	}
+	for (struct job *job = conn->free, *next; job; job = next) {
+		next = job->next_out;
+		free(job);
+	}
+	pthread_cond_destroy(&conn->ready);
+	pthread_cond_destroy(&conn->cond);
+	pthread_mutex_destroy(&conn->mutex);
+	free(conn);
+	return status;
+}
+
+struct client {
+	struct server *server;
+	int fd;
+};
+
+static void *serve_client(void *arg) {
+	struct client *client = arg;
+	struct server *server = client->server;
+	server_run(server, client->fd, client->fd);
+	close(client->fd);
+	free(client);
+	pthread_mutex_lock(&server->mutex);
+	--server->connections;
+	pthread_cond_signal(&server->closed);
+	pthread_mutex_unlock(&server->mutex);
+	return NULL;
+}
+
+int server_listen(struct server *server, const char *path) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	// Replace a socket that was left behind, but nothing else.
+	struct stat sb;
+	if (!stat(path, &sb) && S_ISSOCK(sb.st_mode)) {
+		unlink(path);
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) ||
+			listen(fd, SOMAXCONN)) {
+		close(fd);
+		return -1;
+	}
+	for (;;) {
+		// Leave further connections in the backlog while too many are
+		// open already.
+		pthread_mutex_lock(&server->mutex);
+		while (server->connections >= SERVER_CONNECTIONS_MAX) {
+			pthread_cond_wait(&server->closed, &server->mutex);
+		}
+		pthread_mutex_unlock(&server->mutex);
+		int c = accept(fd, NULL, NULL);
+		if (c < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			break;
+		}
+		struct client *client = malloc(sizeof(struct client));
+		pthread_t thread;
+		if (!client) {
+			close(c);
+			continue;
+		}
+		client->server = server;
+		client->fd = c;
+		pthread_mutex_lock(&server->mutex);
+		++server->connections;
+		pthread_mutex_unlock(&server->mutex);
+		if (pthread_create(&thread, NULL, serve_client, client)) {
+			close(c);
+			free(client);
+			pthread_mutex_lock(&server->mutex);
+			--server->connections;
+			pthread_mutex_unlock(&server->mutex);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	close(fd);
+	// Let open connections finish before the server can be destroyed.
+	pthread_mutex_lock(&server->mutex);
+	while (server->connections > 0) {
+		pthread_cond_wait(&server->closed, &server->mutex);
+	}
+	pthread_mutex_unlock(&server->mutex);
+	return -2;
+}
+
+struct server *server_create(unsigned workers, int framing, int lines,
+		size_t max_record, server_handler handler, void *user) {
+	if (workers < 1) {
+		workers = 1;
+	}
+	struct server *server = calloc(1, sizeof(struct server) +
+			workers * sizeof(pthread_t));
+	if (!server) {
+		return NULL;
+	}
+	server->framing = framing;
+	server->lines = lines;
+	server->max_record = max_record;
+	server->handler = handler;
+	server->user = user;
+	pthread_mutex_init(&server->mutex, NULL);
+	pthread_cond_init(&server->cond, NULL);
+	pthread_cond_init(&server->closed, NULL);
+	if (!(server->args = malloc(workers * sizeof(struct worker)))) {
+		server_destroy(server);
+		return NULL;
+	}
+	// Clients that go away are noticed when writing fails.
+	signal(SIGPIPE, SIG_IGN);
+	for (; server->workers < workers; ++server->workers) {
+		struct worker *worker = server->args + server->workers;
+		worker->server = server;
+		worker->index = server->workers;
+		if (pthread_create(server->threads + server->workers, NULL, work,
+				worker)) {
+			server_destroy(server);
+			return NULL;
+		}
+	}
+	return server;
+}
+
+void server_destroy(struct server *server) {
+	pthread_mutex_lock(&server->mutex);
+	server->stopping = 1;
+	pthread_cond_broadcast(&server->cond);
+	pthread_mutex_unlock(&server->mutex);
+	for (unsigned i = 0; i < server->workers; ++i) {
+		pthread_join(server->threads[i], NULL);
+	}
+	pthread_cond_destroy(&server->closed);
+	pthread_cond_destroy(&server->cond);
+	pthread_mutex_destroy(&server->mutex);
+	free(server->args);
+	free(server);
+}
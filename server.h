@@ -0,0 +1,48 @@
+#ifndef __server_h__
+#define __server_h__
+
+#include <stddef.h>
+
+// Maximum number of requests that are parsed as one batch.
+#define SERVER_BATCH_MAX 64
+// Maximum size of a single response without framing.
+#define SERVER_RESPONSE_MAX 2048
+// Maximum number of batches per connection that may be in flight
+// before the server stops reading requests from that connection.
+#define SERVER_PENDING_MAX 16
+// Maximum number of connections that server_listen() serves at once.
+// Further connections wait in the backlog of the socket.
+#define SERVER_CONNECTIONS_MAX 64
+
+// Called on a worker thread for every request. Writes the response
+// into out and returns its length, which must be smaller than cap.
+// Must be thread-safe. worker is the index of the calling worker, so
+// handlers can keep state per worker.
+typedef size_t (*server_handler)(const char *record, char *out,
+		size_t cap, unsigned worker, void *user);
+
+struct server;
+
+// Start a pool of workers that call handler for every request.
+// Requests use one of the FRAMING_* modes of input.h. Responses are
+// prefixed with their length for FRAMING_LENGTH and terminated by a
+// line break otherwise. Returns NULL on error.
+struct server *server_create(unsigned workers, int framing, int lines,
+		size_t max_record, server_handler handler, void *user);
+
+// Answer pipelined requests from in on out until in ends. Requests
+// that are already buffered are parsed as one batch, so batches grow
+// with the load. Responses are written in the order of the requests.
+// Returns -1 if a request was too long or malformed or if out failed.
+int server_run(struct server *, int in, int out);
+
+// Listen on a Unix domain socket and serve every connection on a
+// thread of its own, with another one that writes its responses. Only
+// returns on error: -1 if it cannot listen on path and -2 if accepting
+// connections failed later, after all open connections were served.
+int server_listen(struct server *, const char *path);
+
+// Stop all workers and free the server.
+void server_destroy(struct server *);
+
+#endif